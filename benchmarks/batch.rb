@@ -0,0 +1,39 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Batch call benchmark.
+#
+# Compares sequential calls, pipelined calls and batched calls on a single
+# connection. Pipelined calls send every request with its own system call,
+# batched ones share a single send for the whole batch.
+#
+# Usage:
+#   benchmarks/batch.rb [url] [duration] [batch size]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+size = Integer(ARGV[2] || 100)
+
+conn = LWTarantool.new(url: url)
+calls = Array.new(size) { |i| ['tostring', [i]] }
+
+modes = {
+  sequential: -> { calls.each { |func, args| conn.call(func, args).result } },
+  pipelined: -> { calls.map { |func, args| conn.call(func, args) }.each(&:result) },
+  batch: -> { conn.call_many(calls).each(&:result) }
+}
+
+modes.each do |name, run|
+  started = Time.now
+  count = 0
+  while Time.now - started < duration
+    run.call
+    count += size
+  end
+
+  puts format('%<name>-10s calls/sec: %<rps>10.1f', name: name, rps: count / (Time.now - started))
+end
+
+conn.disconnect
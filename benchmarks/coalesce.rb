@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Idempotent calls benchmark.
+#
+# Threads share one multiplexed connection and call the same slow function
+# with a few distinct args. Compares plain calls, coalescing of identical
+# calls in flight and coalescing with a reply cache.
+#
+# Usage:
+#   benchmarks/coalesce.rb [url] [duration] [threads]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+threads = Integer(ARGV[2] || 32)
+keys = 4
+
+modes = {
+  plain: {},
+  coalesce: { idempotent: %w[fiber.sleep] },
+  cache: { idempotent: %w[fiber.sleep], cache_bytes: 1 << 20, cache_ttl: 0.05 }
+}
+
+modes.each do |name, options|
+  conn = LWTarantool.new(url: url, multiplex: true, **options)
+  started = Time.now
+
+  counts = Array.new(threads) do |t|
+    Thread.new do
+      count = 0
+      while Time.now - started < duration
+        conn.call('fiber.sleep', [0.001 * (1 + (count + t) % keys)]).wait
+        count += 1
+      end
+      count
+    end
+  end.map(&:value)
+
+  stats = conn.stats
+  puts format('%<name>-10s calls/sec: %<rps>10.1f  sent: %<sent>8d',
+              name: name, rps: counts.sum / (Time.now - started), sent: stats[:replies])
+  conn.disconnect
+end
@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Compare two benchmark suite outputs.
+#
+# Prints calls/sec and p99 latency of every scenario found in both files
+# with the change from the base run in percents.
+#
+# Usage:
+#   benchmarks/compare.rb base.jsonl new.jsonl
+
+require 'json'
+
+METRICS = %w[name calls calls_per_sec p50 p99 commit target ruby].freeze
+
+def load_results(path)
+  File.readlines(path).map { |line| JSON.parse(line) }.to_h do |result|
+    [result.reject { |k, _| METRICS.include?(k) }.merge('name' => result['name']), result]
+  end
+end
+
+def change(base, value)
+  base.zero? ? 0.0 : (value - base) * 100.0 / base
+end
+
+abort 'Usage: benchmarks/compare.rb base.jsonl new.jsonl' unless ARGV.size == 2
+
+base = load_results(ARGV[0])
+new = load_results(ARGV[1])
+
+(base.keys & new.keys).each do |key|
+  was = base[key]
+  now = new[key]
+  params = key.reject { |k, _| k == 'name' }.map { |k, v| "#{k}=#{v}" }.join(' ')
+
+  puts format('%<name>-8s %<params>-32s calls/sec: %<rps>10.1f %<drps>+7.1f%%  p99: %<p99>.6f %<dp99>+7.1f%%',
+              name: key['name'], params: params,
+              rps: now['calls_per_sec'], drps: change(was['calls_per_sec'], now['calls_per_sec']),
+              p99: now['p99'], dp99: change(was['p99'], now['p99']))
+end
@@ -0,0 +1,44 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Corking benchmark.
+#
+# Threads share one multiplexed connection and call a cheap function
+# without batching. Compares calls/sec and send syscalls per request with
+# corking off and on.
+#
+# Usage:
+#   benchmarks/cork.rb [url] [duration] [threads]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+threads = Integer(ARGV[2] || 32)
+
+modes = {
+  plain: {},
+  cork: { cork: true }
+}
+
+modes.each do |name, options|
+  conn = LWTarantool.new(url: url, multiplex: true, **options)
+  started = Time.now
+
+  counts = Array.new(threads) do |t|
+    Thread.new do
+      count = 0
+      while Time.now - started < duration
+        conn.call('tostring', [t]).wait
+        count += 1
+      end
+      count
+    end
+  end.map(&:value)
+
+  stats = conn.stats
+  puts format('%<name>-6s calls/sec: %<rps>10.1f  sends/request: %<spr>.3f  p99: %<p99>.6f',
+              name: name, rps: counts.sum / (Time.now - started),
+              spr: stats[:send_calls].fdiv(stats[:replies]), p99: stats[:latency_p99])
+  conn.disconnect
+end
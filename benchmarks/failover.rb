@@ -0,0 +1,44 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Failover benchmark.
+#
+# Breaks the connection before every call and measures latency of the
+# call which has to reconnect, with and without a hot standby. Without
+# standby the call pays for connect, greeting and auth, with standby it
+# takes over an already established connection.
+#
+# Usage:
+#   benchmarks/failover.rb [url] [count]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+count = Integer(ARGV[1] || 200)
+
+modes = {
+  plain: {},
+  standby: { standby: true }
+}
+
+modes.each do |name, options|
+  conn = LWTarantool.new(url: url, **options)
+  standby = conn.instance_variable_get(:@standby)
+  hist = LWTarantool::Histogram.new
+
+  count.times do
+    # wait for standby to be connected again in background
+    sleep 0.001 until standby.nil? || standby.connected?
+
+    conn.send(:drop) # the same as a connection failure
+    started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    conn.call('tostring', [1]).wait
+    hist.record(Process.clock_gettime(Process::CLOCK_MONOTONIC) - started)
+  end
+
+  puts format('%<name>-8s  p50: %<p50>.6f  p99: %<p99>.6f  failovers: %<failovers>d',
+              name: name, p50: hist.percentile(50), p99: hist.percentile(99),
+              failovers: conn.stats[:failovers])
+
+  conn.disconnect
+end
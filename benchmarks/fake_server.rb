@@ -0,0 +1,183 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Lightweight IPROTO server standing in for Tarantool in benchmarks.
+#
+# Sends a greeting, accepts any auth and ping, and replies to calls:
+# `error` fails with its first argument as a message, `fiber.sleep`
+# replies after its first argument seconds and any other function
+# returns its arguments. Every reply can be delayed, replies ready at
+# once are written with a single system call like Tarantool does.
+#
+# Usage:
+#   benchmarks/fake_server.rb [port] [delay]
+
+require 'msgpack'
+require 'socket'
+
+module LWTarantool
+  module Bench
+    # Fake Tarantool server, see file comment.
+    class FakeServer
+      CODE_OK = 0x00
+      CODE_ERROR = 0x8000
+      ER_PROC_LUA = 32
+      ER_UNKNOWN_REQUEST_TYPE = 48
+
+      REQUEST_TYPE = 0x00
+      SYNC = 0x01
+      SCHEMA_VERSION = 0x05
+      FUNCTION_NAME = 0x22
+      TUPLE = 0x21
+      DATA = 0x30
+      ERROR = 0x31
+
+      CALL_16 = 6
+      AUTH = 7
+      CALL = 10
+      PING = 64
+
+      attr_reader :port
+
+      def initialize(host: '127.0.0.1', port: 3301, delay: 0)
+        @server = TCPServer.new(host, port)
+        @port = @server.addr[1]
+        @delay = delay
+        @clients = []
+      end
+
+      def url
+        "127.0.0.1:#{port}"
+      end
+
+      def start
+        @thread = Thread.new { loop { serve(@server.accept) } }
+        self
+      end
+
+      def run
+        start.join
+      end
+
+      def join
+        @thread.join
+      end
+
+      def stop
+        @thread&.kill
+        @server.close
+        @clients.each { |sock| sock.close rescue nil } # rubocop:disable Style/RescueModifier
+      end
+
+      private
+
+      def serve(sock)
+        @clients << sock
+        sock.setsockopt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY, 1)
+        sock.write(greeting)
+
+        replies = Queue.new
+        Thread.new { write_replies(sock, replies) }
+        Thread.new { read_requests(sock, replies) }
+      end
+
+      def greeting
+        format("%-63s\n%-63s\n", 'Tarantool 2.10.0 (Binary) 00000000-0000-0000-0000-000000000000',
+               [Random.new.bytes(32)].pack('m0'))
+      end
+
+      def read_requests(sock, replies)
+        unpacker = MessagePack::Unpacker.new
+        frame = []
+
+        loop do
+          unpacker.feed_each(sock.readpartial(65_536)) do |obj|
+            frame << obj
+            next if frame.size < 3
+
+            handle(frame[1], frame[2], replies)
+            frame.clear
+          end
+        end
+      rescue IOError, SystemCallError
+        replies.close
+      end
+
+      def handle(header, body, replies)
+        sync = header[SYNC]
+
+        case header[REQUEST_TYPE]
+        when CALL, CALL_16
+          call(sync, body[FUNCTION_NAME], body[TUPLE], replies)
+        when AUTH, PING
+          replies << [clock + @delay, reply(CODE_OK, sync, {})]
+        else
+          replies << [clock + @delay, error(sync, ER_UNKNOWN_REQUEST_TYPE, 'Unknown request type')]
+        end
+      end
+
+      def call(sync, func, args, replies)
+        case func
+        when 'error'
+          replies << [clock + @delay, error(sync, ER_PROC_LUA, args.first.to_s)]
+        when 'fiber.sleep'
+          frame = reply(CODE_OK, sync, DATA => [])
+          Thread.new do
+            sleep(args.first.to_f + @delay)
+            replies << [clock, frame]
+          rescue ClosedQueueError
+            nil
+          end
+        else
+          replies << [clock + @delay, reply(CODE_OK, sync, DATA => args)]
+        end
+      end
+
+      def error(sync, errcode, message)
+        reply(CODE_ERROR | errcode, sync, ERROR => message)
+      end
+
+      def reply(code, sync, body)
+        frame = { REQUEST_TYPE => code, SYNC => sync, SCHEMA_VERSION => 1 }.to_msgpack << body.to_msgpack
+        [0xce, frame.bytesize].pack('CN') << frame
+      end
+
+      # Replies due by now are joined into one write.
+      def write_replies(sock, replies)
+        pending = nil
+
+        loop do
+          due, frame = pending || replies.pop
+          break unless frame
+
+          pending = nil
+          wait = due - clock
+          sleep(wait) if wait.positive?
+
+          buf = frame.dup
+          until replies.empty?
+            pending = replies.pop
+            break if pending[0] > clock
+
+            buf << pending[1]
+            pending = nil
+          end
+          sock.write(buf)
+        end
+      rescue IOError, SystemCallError
+        sock.close rescue nil # rubocop:disable Style/RescueModifier
+      end
+
+      def clock
+        Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      end
+    end
+  end
+end
+
+if $PROGRAM_NAME == __FILE__
+  server = LWTarantool::Bench::FakeServer.new(port: Integer(ARGV[0] || 3301), delay: Float(ARGV[1] || 0))
+  $stdout.sync = true
+  puts "listening on #{server.url}"
+  server.run
+end
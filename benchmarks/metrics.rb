@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Metrics overhead benchmark.
+#
+# Sends pipelined calls of a cheap function through one connection with
+# metrics collection off, with per-function histograms and with both
+# per-function histograms and an on_reply hook. Connection latency
+# histogram and counters are always on.
+#
+# Usage:
+#   benchmarks/metrics.rb [url] [duration] [pipeline]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+pipeline = Integer(ARGV[2] || 100)
+replies = 0
+
+modes = {
+  plain: {},
+  function: { function_metrics: true },
+  hook: { function_metrics: true, on_reply: ->(_req) { replies += 1 } }
+}
+
+base = nil
+modes.each do |name, options|
+  conn = LWTarantool.new(url: url, **options)
+  started = Time.now
+  count = 0
+
+  while Time.now - started < duration
+    Array.new(pipeline) { conn.call('tostring', [count]) }.each(&:wait)
+    count += pipeline
+  end
+
+  rps = count / (Time.now - started)
+  base ||= rps
+  stats = conn.stats
+  puts format('%<name>-9s calls/sec: %<rps>10.1f  overhead: %<overhead>5.2f%%  p99: %<p99>.6f  replies/recv: %<rpr>.1f',
+              name: name, rps: rps, overhead: (1 - rps / base) * 100,
+              p99: stats[:latency_p99], rpr: stats[:replies_per_recv])
+  conn.disconnect
+end
@@ -0,0 +1,44 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Connection pool throughput benchmark.
+#
+# A fixed number of threads share a pool and call a function which sleeps
+# on the tarantool side. A blocking connection serves one waiting thread
+# at a time, so throughput should grow with pool size.
+#
+# Usage:
+#   benchmarks/pool.rb [url] [duration] [delay] [threads]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+delay = Float(ARGV[2] || 0.001)
+threads = Integer(ARGV[3] || 16)
+
+base = nil
+
+[1, 2, 4, 8, 16].each do |size|
+  pool = LWTarantool::Pool.new(url: url, size: size)
+  started = Time.now
+
+  counts = Array.new(threads) do
+    Thread.new do
+      count = 0
+      while Time.now - started < duration
+        pool.call('fiber.sleep', [delay]).wait
+        count += 1
+      end
+      count
+    end
+  end.map(&:value)
+
+  rps = counts.sum / (Time.now - started)
+  base ||= rps
+  latency = pool.stats.sum { |s| s[:latency_avg] } / size
+  puts format('pool size: %<s>2d  calls/sec: %<rps>10.1f  scale: %<scale>5.2f  latency: %<lat>.2f ms',
+              s: size, rps: rps, scale: rps / base, lat: latency * 1000)
+
+  pool.close
+end
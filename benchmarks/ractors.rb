@@ -0,0 +1,63 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Multi-core decoding benchmark.
+#
+# The main Ractor calls a function returning its arguments (any function
+# of benchmarks/fake_server.rb, `function echo(...) return ... end` in
+# Tarantool) with many tuples and decodes replies itself, or detaches
+# them and sends to decoder Ractors. Replies are handed over without
+# copying, so throughput should grow with decoders up to the number of
+# cores.
+#
+# Usage:
+#   benchmarks/ractors.rb [url] [replies] [tuples]
+
+require 'etc'
+require 'lwtarantool'
+
+Warning[:experimental] = false
+
+url = ARGV[0] || '127.0.0.1:3301'
+replies = Integer(ARGV[1] || 2000)
+tuples = Integer(ARGV[2] || 1000)
+
+args = [Array.new(tuples) { |i| [i, "name #{i}", { 'score' => i * 0.5, 'tags' => %w[a b c] }] }]
+depth = 16
+
+fetch = lambda do |conn, &block|
+  (replies / depth).times do
+    Array.new(depth) { conn.call('echo', args) }.each(&block)
+  end
+end
+
+base = nil
+
+[0, 1, 2, 4, Etc.nprocessors].uniq.each do |count|
+  conn = LWTarantool.new(url: url, encoder: :native, send_buf_size: 1 << 24)
+  started = Time.now
+
+  if count.zero?
+    fetch.call(conn) { |req| req.result.size }
+  else
+    decoders = Array.new(count) do
+      Ractor.new do
+        while (reply = Ractor.receive)
+          reply.result.size
+        end
+      end
+    end
+
+    i = 0
+    fetch.call(conn) { |req| decoders[(i += 1) % count].send(req.detach) }
+    decoders.each { |decoder| decoder.send(nil) }
+    decoders.each(&:take)
+  end
+
+  rps = replies / depth * depth / (Time.now - started)
+  base ||= rps
+  puts format('decoders: %<d>-6s  replies/sec: %<rps>8.1f  scale: %<scale>5.2f',
+              d: count.zero? ? 'main' : count, rps: rps, scale: rps / base)
+
+  conn.disconnect
+end
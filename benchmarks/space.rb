@@ -0,0 +1,40 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Space operations benchmark.
+#
+# Compares a native select by primary key with the same lookup made through
+# a Lua function call. Expects a space with unsigned primary key, e.g.:
+#
+#   box.schema.space.create('bench', {id = 513}):create_index('pk')
+#
+# Usage:
+#   benchmarks/space.rb [url] [duration] [space id]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+space = Integer(ARGV[2] || 513)
+keys = 1000
+
+conn = LWTarantool.new(url: url)
+conn.call_many(Array.new(keys) { |i| ['box.space.bench:replace', [[i, "value #{i}"]]] }).each(&:result)
+
+modes = {
+  select: ->(key) { conn.select(space, key).result },
+  call: ->(key) { conn.call('box.space.bench:get', [key]).result }
+}
+
+modes.each do |name, run|
+  started = Time.now
+  count = 0
+  while Time.now - started < duration
+    run.call(count % keys)
+    count += 1
+  end
+
+  puts format('%<name>-10s requests/sec: %<rps>10.1f', name: name, rps: count / (Time.now - started))
+end
+
+conn.disconnect
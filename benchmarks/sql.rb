@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# SQL result decoding benchmark.
+#
+# Compares rows converted into hashes by column names with the columnar
+# result, which decodes rows straight into per-column arrays.
+#
+# Usage:
+#   benchmarks/sql.rb [url] [duration] [rows]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+rows = Integer(ARGV[2] || 10_000)
+
+conn = LWTarantool.new(url: url)
+conn.execute('CREATE TABLE bench_sql (id INTEGER PRIMARY KEY, name STRING, value DOUBLE)').wait
+rows.times.each_slice(100) do |ids|
+  values = Array.new(ids.size, '(?, ?, ?)').join(', ')
+  conn.execute("INSERT INTO bench_sql VALUES #{values}", ids.flat_map { |i| [i, "name #{i}", i * 0.5] }).wait
+end
+
+sql = 'SELECT id, name, value FROM bench_sql'
+
+modes = {
+  hashes: lambda {
+    req = conn.execute(sql)
+    names = req.metadata.map { |col| col[:name] }
+    req.result.map { |row| names.zip(row).to_h }
+  },
+  columns: -> { conn.execute(sql).columns }
+}
+
+modes.each do |name, run|
+  started = Time.now
+  count = 0
+  while Time.now - started < duration
+    run.call
+    count += rows
+  end
+
+  puts format('%<name>-10s rows/sec: %<rps>12.1f', name: name, rps: count / (Time.now - started))
+end
+
+conn.execute('DROP TABLE bench_sql').wait
+conn.disconnect
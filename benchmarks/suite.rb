@@ -0,0 +1,191 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Benchmark suite.
+#
+# Measures calls/sec and p50/p99 reply latency of pipelined calls with
+# different payload sizes, read-driven async requests, error replies,
+# threads sharing a multiplexed connection and fibers on a non-blocking
+# one. Fibers scenarios need a Fiber scheduler (async gem).
+#
+# Runs against Tarantool at --url, or against benchmarks/fake_server.rb
+# started on a free port. JSON format prints one line per scenario, save
+# outputs of two commits and compare them with benchmarks/compare.rb.
+#
+# Usage:
+#   benchmarks/suite.rb [--url url] [--duration seconds] [--delay seconds]
+#                       [--format text|json] [--only call,async,...]
+#   rake bench BENCH_URL=127.0.0.1:3301 BENCH_FORMAT=json > new.jsonl
+
+require 'json'
+require 'optparse'
+require 'rbconfig'
+require 'socket'
+require 'lwtarantool'
+
+options = {
+  url: ENV['BENCH_URL'],
+  duration: Float(ENV['BENCH_DURATION'] || 1),
+  delay: Float(ENV['BENCH_DELAY'] || 0),
+  format: ENV['BENCH_FORMAT'] || 'text',
+  only: ENV['BENCH_ONLY']&.split(',')
+}
+
+OptionParser.new do |opts|
+  opts.on('--url URL', 'Tarantool address, fake server by default') { |v| options[:url] = v }
+  opts.on('--duration SECONDS', Float, 'Duration of every scenario') { |v| options[:duration] = v }
+  opts.on('--delay SECONDS', Float, 'Reply delay of fake server') { |v| options[:delay] = v }
+  opts.on('--format FORMAT', %w[text json], 'Output format: text or json') { |v| options[:format] = v }
+  opts.on('--only NAMES', Array, 'Run only these scenarios') { |v| options[:only] = v }
+end.parse!
+
+# Start fake server in a child process, so it doesn't share GVL with the client.
+def start_fake_server(delay)
+  port = TCPServer.open('127.0.0.1', 0) { |s| s.addr[1] }
+  pid = Process.spawn(RbConfig.ruby, File.join(__dir__, 'fake_server.rb'), port.to_s, delay.to_s, out: File::NULL)
+  at_exit { Process.kill(:TERM, pid) && Process.wait(pid) }
+
+  deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 10
+  begin
+    TCPSocket.new('127.0.0.1', port).close
+  rescue SystemCallError
+    raise 'fake server did not start' if Process.clock_gettime(Process::CLOCK_MONOTONIC) > deadline
+
+    sleep 0.05
+    retry
+  end
+
+  "127.0.0.1:#{port}"
+end
+
+# Run a scenario until deadline, it records latency of every reply to histogram.
+def measure(duration)
+  hist = LWTarantool::Histogram.new
+  started = clock
+  yield(hist, started + duration)
+  elapsed = clock - started
+
+  { calls: hist.count, calls_per_sec: (hist.count / elapsed).round(1),
+    p50: hist.percentile(50), p99: hist.percentile(99) }
+end
+
+def clock
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+def scheduler_class
+  require 'async'
+  Async::Scheduler
+rescue LoadError
+  nil
+end
+
+url = options[:url] || start_fake_server(options[:delay])
+duration = options[:duration]
+payload = ->(size) { 'x' * size }
+
+scenarios = {
+  # call + result, requests are pipelined by depth
+  call: [1, 16, 128].product([16, 1024, 16_384]).map do |depth, size|
+    [{ depth: depth, payload: size }, lambda do |hist, deadline|
+      conn = LWTarantool.new(url: url, send_buf_size: 1 << 20)
+      args = [payload.call(size)]
+      while clock < deadline
+        reqs = Array.new(depth) { conn.call('tostring', args) }
+        reqs.each { |req| req.result && hist.record(req.latency) }
+      end
+      conn.disconnect
+    end]
+  end,
+
+  # replies are taken in order of arrival with Connection#read or #read_all
+  async: [16, 128].product(%w[read read_all]).map do |depth, method|
+    [{ depth: depth, payload: 16, read: method }, lambda do |hist, deadline|
+      conn = LWTarantool.new(url: url, send_buf_size: 1 << 20)
+      args = [payload.call(16)]
+      while clock < deadline
+        depth.times { conn.call('tostring', args) }
+        left = depth
+        while left.positive?
+          reqs = Array(conn.public_send(method))
+          reqs.each { |req| hist.record(req.latency) }
+          left -= reqs.size
+        end
+      end
+      conn.disconnect
+    end]
+  end,
+
+  # error replies carry a message instead of data
+  error: [1, 16].map do |depth|
+    [{ depth: depth }, lambda do |hist, deadline|
+      conn = LWTarantool.new(url: url, send_buf_size: 1 << 20)
+      while clock < deadline
+        reqs = Array.new(depth) { conn.call('error', ['boom']) }
+        reqs.each { |req| req.error && hist.record(req.latency) }
+      end
+      conn.disconnect
+    end]
+  end,
+
+  # threads share a multiplexed connection
+  threads: [1, 4, 16].map do |count|
+    [{ threads: count }, lambda do |hist, deadline|
+      conn = LWTarantool.new(url: url, send_buf_size: 1 << 20, multiplex: true)
+      args = [payload.call(16)]
+      Array.new(count) do
+        Thread.new do
+          while clock < deadline
+            req = conn.call('tostring', args)
+            req.result && hist.record(req.latency)
+          end
+        end
+      end.each(&:join)
+      conn.disconnect
+    end]
+  end,
+
+  # fibers share a non-blocking connection
+  fibers: [16, 128].map do |count|
+    [{ fibers: count }, lambda do |hist, deadline|
+      conn = LWTarantool.new(url: url, send_buf_size: 1 << 20, nonblock: true, multiplex: true)
+      args = [payload.call(16)]
+      Thread.new do
+        Fiber.set_scheduler(scheduler_class.new)
+        count.times do
+          Fiber.schedule do
+            while clock < deadline
+              req = conn.call('tostring', args)
+              req.result && hist.record(req.latency)
+            end
+          end
+        end
+      end.join
+      conn.disconnect
+    end]
+  end
+}
+
+scenarios.select! { |name, _| options[:only].include?(name.to_s) } if options[:only]
+if scenarios.key?(:fibers) && !scheduler_class
+  warn 'fibers: skipped, async gem is not available'
+  scenarios.delete(:fibers)
+end
+
+commit = `git -C #{__dir__} rev-parse --short HEAD 2>/dev/null`.strip
+target = options[:url] ? url : 'fake'
+
+scenarios.each do |name, runs|
+  runs.each do |params, run|
+    result = { name: name }.merge(params, measure(duration, &run))
+
+    if options[:format] == 'json'
+      puts JSON.generate(result.merge(commit: commit, target: target, ruby: RUBY_VERSION))
+    else
+      puts format('%<name>-8s %<params>-32s calls/sec: %<rps>10.1f  p50: %<p50>.6f  p99: %<p99>.6f',
+                  name: name, params: params.map { |k, v| "#{k}=#{v}" }.join(' '),
+                  rps: result[:calls_per_sec], p50: result[:p50], p99: result[:p99])
+    end
+    $stdout.flush
+  end
+end
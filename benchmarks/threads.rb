@@ -0,0 +1,42 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Multi-threaded throughput benchmark.
+#
+# Every thread uses its own connection and calls a function which sleeps
+# on the tarantool side. Connection#read waits for reply without GVL,
+# so throughput should grow close to linearly with threads count.
+#
+# Usage:
+#   benchmarks/threads.rb [url] [duration] [delay]
+
+require 'lwtarantool'
+
+url = ARGV[0] || '127.0.0.1:3301'
+duration = Float(ARGV[1] || 3)
+delay = Float(ARGV[2] || 0.001)
+
+base = nil
+
+[1, 2, 4, 8, 16].each do |threads|
+  conns = Array.new(threads) { LWTarantool.new(url: url) }
+  started = Time.now
+
+  counts = conns.map do |conn|
+    Thread.new do
+      count = 0
+      while Time.now - started < duration
+        conn.call('fiber.sleep', [delay]).wait
+        count += 1
+      end
+      count
+    end
+  end.map(&:value)
+
+  rps = counts.sum / (Time.now - started)
+  base ||= rps
+  puts format('threads: %<t>2d  calls/sec: %<rps>10.1f  scale: %<scale>5.2f',
+              t: threads, rps: rps, scale: rps / base)
+
+  conns.each(&:disconnect)
+end
@@ -1,45 +1,66 @@
 #include <ruby.h>
-#include <ruby/st.h>
-
+#include <ruby/io.h>
+#include <ruby/thread.h>
+
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include <ruby/fiber/scheduler.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <tarantool/tarantool.h>
 #include <tarantool/tnt_net.h>
 #include <tarantool/tnt_opt.h>
+#include <tarantool/tnt_proto.h>
+#include <msgpuck.h>
+#include <uri.h>
 
 #include "lwtarantool.h"
 
 
-static int
-lwt_conn_interrupt_request(uint64_t *id, VALUE req) {
-  struct tnt_reply *reply = tnt_reply_init(NULL);
-
-  char * error = "Request canceled due to connection close";
-
-  reply->code = -1;
-  reply->error = error;
-  reply->error_end = error + strlen(error);
+static void
+lwt_conn_fail_request(VALUE req, const char *error) {
+  struct tnt_reply reply;
+  tnt_reply_init(&reply);
 
-  lwt_request_add_reply(req, reply);
+  reply.code = -1;
+  reply.error = error;
+  reply.error_end = error + strlen(error);
 
-  return ST_DELETE;
+  lwt_request_add_reply(req, &reply, NULL);
 }
 
-static int
-lwt_conn_mark_request(uint64_t *id, VALUE req) {
-  rb_gc_mark(req);
-  return ST_CONTINUE;
+static void
+lwt_conn_interrupt_request(VALUE req) {
+  lwt_conn_fail_request(req, "Request canceled due to connection close");
 }
 
 static void
 lwt_conn_mark(void *s) {
   lwt_conn_t *conn = (lwt_conn_t *) s;
-  st_foreach(conn->requests, lwt_conn_mark_request, 0);
+  rb_gc_mark_movable(conn->io);
+  lwt_slots_mark(&conn->requests);
+}
+
+static void
+lwt_conn_compact(void *s) {
+  lwt_conn_t *conn = (lwt_conn_t *) s;
+  conn->io = rb_gc_location(conn->io);
+  lwt_slots_compact(&conn->requests);
 }
 
 static void
-lwt_conn_dealloc(lwt_conn_t *conn) {
+lwt_conn_dealloc(void *s) {
+  lwt_conn_t *conn = (lwt_conn_t *) s;
+
   if (conn == NULL)
     return;
 
@@ -47,21 +68,37 @@ lwt_conn_dealloc(lwt_conn_t *conn) {
     tnt_close(conn->tnt);
     tnt_stream_free(conn->tnt);
   }
-  if (conn->requests) {
-    st_clear(conn->requests);
-    st_free_table(conn->requests);
-  }
+  lwt_slots_free(&conn->requests);
+  if (conn->pool)
+    lwt_pool_close(conn->pool);
+
+  xfree(conn);
+}
+
+static size_t
+lwt_conn_memsize(const void *s) {
+  const lwt_conn_t *conn = (const lwt_conn_t *) s;
+  return sizeof(lwt_conn_t) + lwt_slots_memsize(&conn->requests);
 }
 
+static const rb_data_type_t lwt_conn_type = {
+  "LWTarantool::Connection",
+  { lwt_conn_mark, lwt_conn_dealloc, lwt_conn_memsize, lwt_conn_compact, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
 static VALUE
 lwt_conn_alloc( VALUE klass) {
   lwt_conn_t * conn;
   conn = ZALLOC(lwt_conn_t);
 
+  conn->io = Qnil;
   conn->tnt = tnt_net(NULL);
-  conn->requests = st_init_numtable();
+  lwt_slots_init(&conn->requests);
+  conn->pool = lwt_pool_new();
 
-  return Data_Wrap_Struct( klass, lwt_conn_mark, lwt_conn_dealloc, conn);
+  return TypedData_Wrap_Struct( klass, &lwt_conn_type, conn);
 }
 
 static void
@@ -92,13 +129,576 @@ lwt_conn_raise_error(lwt_conn_t *conn) {
   }
 }
 
+/*
+ * IO object for connection socket.
+ *
+ * It doesn't own the descriptor, so it must not be closed.
+ */
+static VALUE
+lwt_conn_get_io(lwt_conn_t *conn) {
+  if (conn->io == Qnil) {
+    conn->io = rb_funcall(rb_cIO, rb_intern("for_fd"), 2, INT2FIX(tnt_fd(conn->tnt)), rb_str_new_cstr("r+"));
+    rb_funcall(conn->io, rb_intern("autoclose="), 1, Qfalse);
+  }
+
+  return conn->io;
+}
+
+/*
+ * Wait for socket events without GVL.
+ *
+ * In nonblock mode the current Fiber scheduler (if any) is used,
+ * so only the current fiber is blocked.
+ *
+ * Negative timeout means infinite wait.
+ * Returns 0 if socket is ready, 1 on timeout and -1 on error.
+ */
+static int
+lwt_conn_wait(lwt_conn_t *conn, int events, double timeout) {
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+  if (conn->nonblock) {
+    VALUE scheduler = rb_fiber_scheduler_current();
+
+    if (scheduler != Qnil) {
+      VALUE tmout = timeout < 0 ? Qnil : DBL2NUM(timeout);
+      VALUE res = rb_fiber_scheduler_io_wait(scheduler, lwt_conn_get_io(conn), INT2FIX(events), tmout);
+      return (timeout >= 0 && !RTEST(res)) ? 1 : 0;
+    }
+  }
+#endif
+
+  struct timeval tv, *tvp = NULL;
+  if (timeout >= 0) {
+    tv.tv_sec = (time_t)timeout;
+    tv.tv_usec = (suseconds_t)((timeout - tv.tv_sec) * 1e6);
+    tvp = &tv;
+  }
+
+  switch (rb_wait_for_single_fd(tnt_fd(conn->tnt), events, tvp)) {
+    case -1:
+      return -1;
+    case 0:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Send all buffered requests.
+ *
+ * Unsent data is kept at the head of sbuf while waiting for the socket,
+ * so an interrupted or partial write doesn't break the stream.
+ */
+static int
+lwt_conn_flush(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *sbuf = &sn->sbuf;
+  size_t off = 0;
+
+  while (off < sbuf->off) {
+    ssize_t r = send(sn->fd, sbuf->buf + off, sbuf->off - off, MSG_DONTWAIT);
+    conn->send_calls++;
+
+    if (r > 0) {
+      off += r;
+      conn->bytes_sent += r;
+      continue;
+    }
+
+    if (r < 0 && errno == EINTR)
+      continue;
+
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      memmove(sbuf->buf, sbuf->buf + off, sbuf->off - off);
+      sbuf->off -= off;
+      off = 0;
+
+      if (lwt_conn_wait(conn, RB_WAITFD_OUT, -1) == 0)
+        continue;
+    }
+
+    sn->error = TNT_ESYSTEM;
+    sn->errno_ = errno;
+    return -1;
+  }
+
+  sbuf->off = 0;
+  conn->corked = 0;
+  return 0;
+}
+
+/*
+ * Make room for a request of given size in sbuf.
+ *
+ * Without it tnt_io_send() flushes overflowed buffer by itself
+ * with a blocking send.
+ */
+static int
+lwt_conn_reserve(lwt_conn_t *conn, size_t size) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+
+  if (sn->sbuf.off + size <= sn->sbuf.size)
+    return 0;
+
+  return lwt_conn_flush(conn);
+}
+
+/*
+ * Receive data until the whole reply frame is buffered in rbuf.
+ *
+ * Socket is read with MSG_DONTWAIT and waiting for data happens in
+ * lwt_conn_wait() without GVL, so other threads keep running.
+ * The wait is interruptible; already received bytes stay in rbuf,
+ * so an interrupted read doesn't break the stream.
+ *
+ * Waits for timeout seconds at most, negative timeout means infinite wait.
+ * Returns 1 if reply is still incomplete after timeout.
+ */
+static int
+lwt_conn_fill(lwt_conn_t *conn, double timeout) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *rbuf = &sn->rbuf;
+  double deadline = lwt_clock() + timeout;
+
+  while (1) {
+    size_t avail = rbuf->top - rbuf->off;
+    size_t need = 0;
+
+    int rc = tnt_reply(NULL, rbuf->buf + rbuf->off, avail, &need);
+    if (rc == 0)
+      return 0;
+
+    if (rc == -1) {
+      sn->error = TNT_EFAIL;
+      return -1;
+    }
+
+    // reply larger than buffer, so grow buffer
+    if (avail + need > rbuf->size) {
+      char *buf = tnt_mem_realloc(rbuf->buf, avail + need);
+      if (buf == NULL) {
+        sn->error = TNT_EMEMORY;
+        return -1;
+      }
+      rbuf->buf = buf;
+      rbuf->size = avail + need;
+    }
+
+    // not enough space at the buffer tail
+    if (rbuf->off + avail + need > rbuf->size) {
+      memmove(rbuf->buf, rbuf->buf + rbuf->off, avail);
+      rbuf->off = 0;
+      rbuf->top = avail;
+    }
+
+    ssize_t r = recv(sn->fd, rbuf->buf + rbuf->top, rbuf->size - rbuf->top, MSG_DONTWAIT);
+    conn->recv_calls++;
+
+    if (r > 0) {
+      rbuf->top += r;
+      conn->bytes_received += r;
+      conn->recv_data_calls++;
+      continue;
+    }
+
+    if (r == 0) {
+      sn->error = TNT_ESYSTEM;
+      sn->errno_ = ECONNRESET;
+      return -1;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      sn->error = TNT_ESYSTEM;
+      sn->errno_ = errno;
+      return -1;
+    }
+
+    double left = -1;
+    if (timeout >= 0) {
+      left = deadline - lwt_clock();
+      if (left <= 0)
+        return 1;
+    }
+
+    switch (lwt_conn_wait(conn, RB_WAITFD_IN, left)) {
+      case 0:
+        break;
+      case 1:
+        return 1;
+      default:
+        sn->error = TNT_ESYSTEM;
+        sn->errno_ = errno;
+        return -1;
+    }
+  }
+}
+
+/*
+ * Connection establishment.
+ *
+ * Unlike tnt_connect() nothing here blocks with GVL held: the host is
+ * resolved without GVL (or by Fiber scheduler in nonblock mode), the
+ * socket connects and the greeting is received in non-blocking mode
+ * waiting for them in lwt_conn_wait(). Auth request is sent right after
+ * the greeting and its reply is taken with the first replies read, so
+ * connect costs a single round-trip.
+ */
+
+// Socket buffers are requested as large as the system allows, like tnt_io does
+#define LWT_SOCK_BUF_MAX (128 * 1024 * 1024)
+
+typedef struct {
+  const char *host;
+  const char *service;
+  struct addrinfo hints;
+  struct addrinfo *res;
+  int rc;
+} lwt_resolve_t;
+
+static void *
+lwt_conn_getaddrinfo(void *ptr) {
+  lwt_resolve_t *r = ptr;
+
+  r->rc = getaddrinfo(r->host, r->service, &r->hints, &r->res);
+  return NULL;
+}
+
+/*
+ * Resolve TCP address of connection URI.
+ *
+ * Host names are resolved to IPv4 addresses only, as tnt_io does, IPv6
+ * is used for bracketed IPv6 literals.
+ */
+static int
+lwt_conn_resolve(lwt_conn_t *conn, struct sockaddr_storage *addr, socklen_t *len) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct uri *uri = sn->opt.uri;
+  char host[URI_MAXHOST], service[NI_MAXSERV];
+  lwt_resolve_t r;
+
+  snprintf(host, sizeof(host), "%.*s", (int)uri->host_len, uri->host);
+  if (uri->service != NULL)
+    snprintf(service, sizeof(service), "%.*s", (int)uri->service_len, uri->service);
+  else
+    snprintf(service, sizeof(service), "3301");
+
+  memset(&r, 0, sizeof(r));
+  r.host = host;
+  r.service = service;
+  r.hints.ai_family = uri->host_hint == URI_IPV6 ? AF_INET6 : AF_INET;
+  r.hints.ai_socktype = SOCK_STREAM;
+  r.rc = EAI_NONAME;
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_ADDRESS_RESOLVE
+  VALUE scheduler = conn->nonblock ? rb_fiber_scheduler_current() : Qnil;
+
+  if (uri->host_hint == URI_NAME && scheduler != Qnil) {
+    VALUE addrs = rb_fiber_scheduler_address_resolve(scheduler, rb_str_new_cstr(host));
+
+    if (RB_TYPE_P(addrs, T_ARRAY)) {
+      long i;
+
+      // the scheduler returns addresses of any family, IPv6 ones are skipped
+      // by getaddrinfo() with AF_INET hint and the first IPv4 one is taken
+      r.hints.ai_flags = AI_NUMERICHOST;
+      for (i = 0; i < RARRAY_LEN(addrs) && r.rc != 0; i++) {
+        VALUE ip = rb_obj_as_string(RARRAY_AREF(addrs, i));
+        r.host = StringValueCStr(ip);
+        lwt_conn_getaddrinfo(&r);
+      }
+
+      goto resolved;
+    }
+  }
+#endif
+
+  rb_thread_call_without_gvl(lwt_conn_getaddrinfo, &r, RUBY_UBF_IO, NULL);
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_ADDRESS_RESOLVE
+resolved:
+#endif
+  if (r.rc != 0 || r.res == NULL) {
+    sn->error = TNT_ERESOLVE;
+    return -1;
+  }
+
+  memcpy(addr, r.res->ai_addr, r.res->ai_addrlen);
+  *len = r.res->ai_addrlen;
+  freeaddrinfo(r.res);
+
+  return 0;
+}
+
+static int
+lwt_conn_setopts(lwt_conn_t *conn, int family) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  int opt = 1, size = LWT_SOCK_BUF_MAX;
+
+  if (family != AF_UNIX && setsockopt(sn->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1)
+    return -1;
+
+  // the kernel caps buffer sizes by its own limits
+  setsockopt(sn->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(sn->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  int flags = fcntl(sn->fd, F_GETFL);
+  if (flags == -1 || fcntl(sn->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    return -1;
+
+  return 0;
+}
+
+/*
+ * Seconds left until deadline for lwt_conn_wait().
+ */
+static double
+lwt_conn_left(double deadline) {
+  double left = deadline - lwt_clock();
+  return left > 0 ? left : 0;
+}
+
+/*
+ * Wait for non-blocking connect to complete.
+ */
+static int
+lwt_conn_wait_connected(lwt_conn_t *conn, double deadline) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  switch (lwt_conn_wait(conn, RB_WAITFD_OUT, lwt_conn_left(deadline))) {
+    case 0:
+      break;
+    case 1:
+      sn->error = TNT_ETMOUT;
+      return -1;
+    default:
+      return -1;
+  }
+
+  if (getsockopt(sn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+    return -1;
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+lwt_conn_read_greeting(lwt_conn_t *conn, double deadline) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  size_t off = 0;
+
+  while (off < TNT_GREETING_SIZE) {
+    ssize_t r = recv(sn->fd, sn->greeting + off, TNT_GREETING_SIZE - off, MSG_DONTWAIT);
+
+    if (r > 0) {
+      off += r;
+      continue;
+    }
+
+    if (r == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return -1;
+
+    switch (lwt_conn_wait(conn, RB_WAITFD_IN, lwt_conn_left(deadline))) {
+      case 0:
+        break;
+      case 1:
+        sn->error = TNT_ETMOUT;
+        return -1;
+      default:
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Put auth request into sbuf and send it without waiting for reply.
+ */
+static int
+lwt_conn_send_auth(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct uri *uri = sn->opt.uri;
+
+  if (uri->login == NULL || uri->password == NULL)
+    return 0;
+
+  conn->auth_sync = conn->tnt->reqid;
+  if (tnt_auth(conn->tnt, uri->login, uri->login_len, uri->password, uri->password_len) < 0)
+    return -1;
+
+  conn->auth_pending = 1;
+  return lwt_conn_flush(conn);
+}
+
+/*
+ * Open socket, receive greeting and send auth.
+ *
+ * Returns -1 with sn->error set on failure, the socket is left for
+ * caller to close.
+ */
+static int
+lwt_conn_open(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct uri *uri = sn->opt.uri;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  double deadline = lwt_clock() + sn->opt.tmout_connect.tv_sec + sn->opt.tmout_connect.tv_usec / 1e6;
+
+  if (!sn->inited && tnt_init(conn->tnt) < 0)
+    return -1;
+
+  if (uri->host_hint == URI_UNIX) {
+    struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    snprintf(un->sun_path, sizeof(un->sun_path), "%.*s", (int)uri->service_len, uri->service);
+    len = sizeof(*un);
+  } else if (lwt_conn_resolve(conn, &addr, &len) < 0) {
+    return -1;
+  }
+
+  sn->error = TNT_ESYSTEM;
+
+  sn->fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (sn->fd < 0 || lwt_conn_setopts(conn, addr.ss_family) < 0)
+    goto error;
+
+  if (connect(sn->fd, (struct sockaddr *)&addr, len) < 0) {
+    if (errno != EINPROGRESS || lwt_conn_wait_connected(conn, deadline) < 0)
+      goto error;
+  }
+
+  if (lwt_conn_read_greeting(conn, deadline) < 0)
+    goto error;
+
+  // socket stays non-blocking in nonblock mode only
+  if (!conn->nonblock) {
+    int flags = fcntl(sn->fd, F_GETFL);
+    if (flags == -1 || fcntl(sn->fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+      goto error;
+  }
+
+  sn->connected = 1;
+  sn->error = TNT_EOK;
+
+  if (lwt_conn_send_auth(conn) < 0)
+    goto error;
+
+  return 0;
+
+error:
+  if (sn->error == TNT_ESYSTEM)
+    sn->errno_ = errno;
+  return -1;
+}
+
 static VALUE
 lwt_conn_connect(VALUE self) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  conn->io = Qnil;
+  conn->corked = 0;
+  conn->auth_pending = 0;
 
-  if (tnt_connect(conn->tnt) < 0)
+  // it may be another server, so schema is loaded again
+  conn->schema_id = 0;
+  conn->schema_seen = 0;
+
+  tnt_close(conn->tnt);
+  if (lwt_conn_open(conn) < 0) {
+    enum tnt_error error = TNT_SNET_CAST(conn->tnt)->error;
+
+    tnt_close(conn->tnt);
+    TNT_SNET_CAST(conn->tnt)->error = error;
+    conn->io = Qnil;
     lwt_conn_raise_error(conn);
+  }
+
+  return Qtrue;
+}
+
+/*
+ * Check that peer hasn't closed a connected socket.
+ */
+static int
+lwt_conn_alive(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  char c;
+
+  if (!sn->connected)
+    return 0;
+
+  ssize_t r = recv(sn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+/*
+ * Give transport of connected standby to a failed connection, taking
+ * its closed one.
+ *
+ * Socket, buffers, pending auth and schema move together, requests and
+ * metrics stay with their connection. Both connections must be locked.
+ * Returns false if the target is still connected, or if standby is not
+ * connected or its socket was closed by peer, such a standby is closed.
+ */
+static VALUE
+lwt_conn_hand_over(VALUE self, VALUE target) {
+  lwt_conn_t * standby, * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, standby);
+  TypedData_Get_Struct(target, lwt_conn_t, &lwt_conn_type, conn);
+
+  if (conn == standby || TNT_SNET_CAST(conn->tnt)->connected)
+    return Qfalse;
+
+  if (!lwt_conn_alive(standby)) {
+    tnt_close(standby->tnt);
+    standby->io = Qnil;
+    return Qfalse;
+  }
+
+  struct tnt_stream *tnt = conn->tnt;
+  conn->tnt = standby->tnt;
+  standby->tnt = tnt;
+
+  VALUE io = conn->io;
+  conn->io = standby->io;
+  standby->io = io;
+
+  conn->auth_sync = standby->auth_sync;
+  conn->auth_pending = standby->auth_pending;
+  conn->schema_id = standby->schema_id;
+  conn->schema_seen = standby->schema_seen;
+  conn->corked = 0;
+  conn->failovers++;
+
+  standby->auth_pending = 0;
+  standby->schema_id = 0;
+  standby->schema_seen = 0;
+  standby->corked = 0;
+
+  VALUE url = rb_ivar_get(target, rb_intern("@url"));
+  rb_iv_set(target, "@url", rb_ivar_get(self, rb_intern("@url")));
+  rb_iv_set(self, "@url", url);
 
   return Qtrue;
 }
@@ -106,10 +706,17 @@ lwt_conn_connect(VALUE self) {
 static VALUE
 lwt_conn_disconnect(VALUE self) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  // wake up readers waiting for the socket in other threads
+  if (tnt_fd(conn->tnt) >= 0)
+    shutdown(tnt_fd(conn->tnt), SHUT_RDWR);
 
+  conn->io = Qnil;
+  conn->corked = 0;
+  conn->auth_pending = 0;
   tnt_close(conn->tnt);
-  st_foreach(conn->requests, lwt_conn_interrupt_request, 0);
+  lwt_slots_clear(&conn->requests, lwt_conn_interrupt_request);
 
   return Qtrue;
 }
@@ -156,17 +763,43 @@ _lwt_conn_set_timeval_option(VALUE args, const char *option, lwt_conn_t *conn, e
     rb_raise(rb_eArgError, "invalid %s value", option);
 }
 
+// Default cork window in seconds and send buffer size flushed at once
+#define LWT_CORK_WINDOW 0.0002
+#define LWT_CORK_BYTES 8192
+
 /**
  * Document-class: LWTarantool::Connection
  *
  * Create new connection to Tarantool.
  *
+ * Auth request is pipelined with the first requests: they are sent before
+ * its reply is read, so with wrong login or password they run as guest,
+ * and LWTarantool::LoginError is raised by the first read.
+ *
  * @param [Hash] args the options to establish connection
  * @option args [String] :url The tarantool address
  * @option args [Integer] :recv_buf_size Receive buffer size (unknown effect)
  * @option args [Integer] :send_buf_size Send buffer size (maximum request size)
  * @option args [Integer] :connect_timeout Timeout for establish tcp connection to Tarantool
  * @option args [Integer] :open_timeout The same as connect_timeout
+ * @option args [Boolean] :nonblock Use non-blocking socket and wait for it through Fiber scheduler
+ * @option args [Boolean] :multiplex Share connection between threads without locking it while waiting for responses
+ * @option args [Boolean] :connect Connect immediately (default), otherwise on the first call
+ * @option args [Numeric] :timeout Default timeout of requests in seconds
+ * @option args [Symbol] :encoder Encoder of function arguments: :msgpack (default) uses msgpack gem,
+ *   :native encodes them straight into connection send buffer
+ * @option args [Array<String>] :idempotent Functions which calls with the same args share a request
+ *   while it is in flight
+ * @option args [Integer] :cache_bytes Memory limit of idempotent calls cache, no cache by default
+ * @option args [Numeric] :cache_ttl Seconds a cached reply is served for since its request was sent
+ * @option args [Boolean] :function_metrics Keep a latency histogram per called function
+ * @option args [#call, Symbol] :on_reply Called with every request once its reply is read,
+ *   :active_support instruments "reply.lwtarantool" with ActiveSupport::Notifications
+ * @option args [Boolean, Numeric] :cork Keep requests of concurrent callers in send buffer
+ *   for up to given seconds (200us if true) to send them together
+ * @option args [Integer] :cork_bytes Send corked requests at once when they take that many bytes
+ * @option args [Boolean, String] :standby Keep a connection to the same (true) or given url connected
+ *   and authenticated in background, it's taken over when the connection fails
  *
  * @example
  *   LWTarantool::Connection.new(url: 'tcp://127.0.0.1:3301')
@@ -175,20 +808,37 @@ _lwt_conn_set_timeval_option(VALUE args, const char *option, lwt_conn_t *conn, e
  *
  * @raise [LWTarantool::ResolvError] destination host can't be resolved
  * @raise [LWTarantool::TimeoutError] connect timeout reached
- * @raise [LWTarantool::LoginError] incorrect login or password
  * @raise [LWTarantool::SystemError] connection failed
  * @raise [LWTarantool::UnknownError] unknown error
  */
 static VALUE
 lwt_conn_initialize(VALUE self, VALUE args) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
 
   VALUE val;
 
   val = rb_mutex_new();
   rb_iv_set(self, "@mutex", val);
 
+  val = rb_mutex_new();
+  rb_iv_set(self, "@read_mutex", val);
+
+  val = rb_mutex_new();
+  rb_iv_set(self, "@waiters_mutex", val);
+
+  val = rb_hash_new();
+  rb_iv_set(self, "@waiters", val);
+
+  val = rb_mutex_new();
+  rb_iv_set(self, "@schema_mutex", val);
+
+  val = rb_hash_new();
+  rb_iv_set(self, "@statements", val);
+
+  val = rb_mutex_new();
+  rb_iv_set(self, "@statements_mutex", val);
+
   if (TYPE(args) != T_HASH)
     rb_raise(rb_eArgError, "args must be a Hash");
 
@@ -197,9 +847,57 @@ lwt_conn_initialize(VALUE self, VALUE args) {
   _lwt_conn_set_timeval_option(args, "connect_timeout", conn, TNT_OPT_TMOUT_CONNECT);
   _lwt_conn_set_timeval_option(args, "open_timeout", conn, TNT_OPT_TMOUT_CONNECT);
 
-  // TODO: How should we process a partial read/write before timeout?
-  //_lwt_conn_set_timeval_option(args, "receive_timeout", conn, TNT_OPT_TMOUT_RECV);
-  //_lwt_conn_set_timeval_option(args, "send_timeout", conn, TNT_OPT_TMOUT_SEND);
+  conn->nonblock = RTEST(rb_hash_aref(args, ID2SYM(rb_intern("nonblock"))));
+  conn->multiplex = RTEST(rb_hash_aref(args, ID2SYM(rb_intern("multiplex"))));
+
+  val = rb_hash_aref(args, ID2SYM(rb_intern("encoder")));
+  if (val == ID2SYM(rb_intern("native")))
+    conn->native_encoder = 1;
+  else if (val != Qnil && val != ID2SYM(rb_intern("msgpack")))
+    rb_raise(rb_eArgError, "encoder must be :msgpack or :native");
+
+  // requests time out individually, a partial reply stays buffered in rbuf
+  val = rb_hash_aref(args, ID2SYM(rb_intern("timeout")));
+  if (val != Qnil && !rb_obj_is_kind_of(val, rb_cNumeric))
+    rb_raise(rb_eArgError, "timeout must be a Numeric");
+  rb_iv_set(self, "@timeout", val);
+
+  // calls of idempotent functions are coalesced and optionally cached
+  val = rb_funcall(rb_const_get(lwt_Class, rb_intern("CallCache")), rb_intern("for"), 1, args);
+  rb_iv_set(self, "@call_cache", val);
+
+  // metrics collected in Ruby, out of the connection lock
+  rb_iv_set(self, "@lock_wait_time", DBL2NUM(0.0));
+
+  val = RTEST(rb_hash_aref(args, ID2SYM(rb_intern("function_metrics")))) ? rb_hash_new() : Qnil;
+  rb_iv_set(self, "@function_latency", val);
+  rb_iv_set(self, "@metrics_mutex", NIL_P(val) ? Qnil : rb_mutex_new());
+
+  val = rb_hash_aref(args, ID2SYM(rb_intern("on_reply")));
+  if (val == ID2SYM(rb_intern("active_support")))
+    val = rb_const_get(rb_const_get(lwt_Class, rb_intern("Connection")), rb_intern("ACTIVE_SUPPORT_HOOK"));
+  else if (val != Qnil && !rb_respond_to(val, rb_intern("call")))
+    rb_raise(rb_eArgError, "on_reply must respond to call or be :active_support");
+  rb_iv_set(self, "@on_reply", val);
+
+  // requests of concurrent callers are corked into one send
+  val = rb_hash_aref(args, ID2SYM(rb_intern("cork")));
+  if (val == Qtrue)
+    conn->cork_window = LWT_CORK_WINDOW;
+  else if (RTEST(val) && rb_obj_is_kind_of(val, rb_cNumeric) && NUM2DBL(val) > 0)
+    conn->cork_window = NUM2DBL(val);
+  else if (RTEST(val))
+    rb_raise(rb_eArgError, "cork must be true or a positive Numeric");
+
+  val = rb_hash_aref(args, ID2SYM(rb_intern("cork_bytes")));
+  if (val != Qnil && (!RB_INTEGER_TYPE_P(val) || NUM2LL(val) <= 0))
+    rb_raise(rb_eArgError, "cork_bytes must be a positive Integer");
+  conn->cork_bytes = NIL_P(val) ? LWT_CORK_BYTES : NUM2SIZET(val);
+
+  rb_iv_set(self, "@cork", conn->cork_window > 0 ? DBL2NUM(conn->cork_window) : Qnil);
+  rb_iv_set(self, "@flush_signal", Qnil);
+  if (conn->cork_window > 0)
+    rb_funcall(self, rb_intern("start_flusher"), 0);
 
   // handle url option
   val = rb_hash_aref(args, ID2SYM(rb_intern( "url")));
@@ -216,122 +914,1185 @@ lwt_conn_initialize(VALUE self, VALUE args) {
 
   rb_iv_set(self, "@url", val);
 
-  lwt_conn_connect(self);
+  // hot standby to the same or alternate url is connected in background
+  val = rb_hash_aref(args, ID2SYM(rb_intern("standby")));
+  if (RTEST(val) && val != Qtrue && TYPE(val) != T_STRING)
+    rb_raise(rb_eArgError, "standby must be true or a String");
+  rb_iv_set(self, "@standby", Qnil);
+
+  if (rb_hash_aref(args, ID2SYM(rb_intern("connect"))) != Qfalse)
+    lwt_conn_connect(self);
+
+  if (RTEST(val))
+    rb_funcall(self, rb_intern("start_standby"), 1, args);
 
   return Qnil;
 }
 
-static VALUE
-lwt_conn_call(VALUE self, VALUE func, VALUE args) {
-  lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
-
-  if (TYPE(func) != T_STRING)
-    rb_raise(rb_eArgError, "function name must be a String");
+/*
+ * Size of call args encoded into msgpack.
+ *
+ * Args are either a String with an already encoded msgpack array
+ * or an Array encoded by the native encoder.
+ */
+static size_t
+lwt_conn_args_sizeof(VALUE args) {
+  if (TYPE(args) == T_ARRAY)
+    return lwt_pack_sizeof(args);
 
   if (TYPE(args) != T_STRING)
+    rb_raise(rb_eArgError, "args must be an Array or a string with msgpack array");
+
+  const char *pos = RSTRING_PTR(args);
+  const char *end = pos + RSTRING_LEN(args);
+
+  if (pos == end || mp_typeof(*pos) != MP_ARRAY || mp_check(&pos, end) || pos != end)
     rb_raise(rb_eArgError, "args must be a string with msgpack array");
 
-  int func_len = RSTRING_LEN(func);
-  char func_name[func_len+1];
-  func_name[func_len] = '\0';
-  strncpy(func_name, RSTRING_PTR(func), func_len);
+  return RSTRING_LEN(args);
+}
 
-  uint64_t reqid = conn->tnt->reqid;
-  VALUE req;
+/*
+ * Encode args by the native encoder into a String.
+ *
+ * Calls of idempotent functions are compared by encoded args.
+ */
+static VALUE
+lwt_conn_pack(VALUE self, VALUE args) {
+  size_t size = lwt_pack_sizeof(args);
+  VALUE str = rb_str_buf_new(size);
 
-  struct tnt_stream * data;
-  data = tnt_object(NULL);
-  if (data == NULL)
-    rb_raise(rb_eNoMemError, "Can't create tnt_object");
+  lwt_pack_encode(RSTRING_PTR(str), args);
+  rb_str_set_len(str, size);
 
-  if (data->write(data, RSTRING_PTR(args), RSTRING_LEN(args)) < 0) {
-    tnt_stream_free(data);
-    rb_raise(rb_eNoMemError, "Can't store args");
-  }
+  return str;
+}
 
-  if (tnt_call(conn->tnt, func_name, func_len, data) < 0) {
-    tnt_stream_free(data);
-    lwt_conn_raise_error(conn);
-  }
+/*
+ * Field of a request body.
+ */
+typedef struct {
+  int key;
+  int type;
+  uint64_t num;
+  VALUE val;
+  size_t len;
+} lwt_field_t;
 
-  if (tnt_flush(conn->tnt) < 0) {
-    tnt_stream_free(data);
-    lwt_conn_raise_error(conn);
-  }
+#define LWT_FIELD_UINT 0
+#define LWT_FIELD_STR 1
+#define LWT_FIELD_MSGPACK 2
 
-  tnt_stream_free(data);
+static void
+lwt_field_uint(lwt_field_t *field, int key, VALUE num, const char *name) {
+  int negative = FIXNUM_P(num) ? FIX2LONG(num) < 0 : TYPE(num) != T_BIGNUM || RBIGNUM_NEGATIVE_P(num);
 
-  req = lwt_request_create(self, reqid);
-  st_insert( conn->requests, reqid, req);
+  if (negative)
+    rb_raise(rb_eArgError, "%s must be a non-negative Integer", name);
 
-  return req;
+  field->key = key;
+  field->type = LWT_FIELD_UINT;
+  field->num = NUM2ULL(num);
+  field->len = 0;
 }
 
-static VALUE
-lwt_conn_read(VALUE self) {
-  lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+static void
+lwt_field_str(lwt_field_t *field, int key, VALUE str, const char *name) {
+  if (TYPE(str) != T_STRING)
+    rb_raise(rb_eArgError, "%s must be a String", name);
 
-  VALUE req;
-  struct tnt_reply *reply = tnt_reply_init(NULL);
+  if (RSTRING_LEN(str) == 0)
+    rb_raise(rb_eArgError, "%s must not be empty", name);
 
-  int rc = conn->tnt->read_reply(conn->tnt, reply);
-  //printf("sync: %d, code: %d, err: %d, errno: %d, strerr: %s\n", rc, reply->sync, reply->code, tnt_error(conn->tnt), tnt_errno(conn->tnt), tnt_strerror(conn->tnt));
+  field->key = key;
+  field->type = LWT_FIELD_STR;
+  field->val = str;
+  field->len = 0;
+}
 
-  if (rc == 1) {
-    tnt_reply_free(reply);
-    return Qnil;
+/*
+ * An Array or a String with msgpack array, it's checked when frame is sized.
+ */
+static void
+lwt_field_msgpack(lwt_field_t *field, int key, VALUE args) {
+  if (TYPE(args) != T_ARRAY && TYPE(args) != T_STRING)
+    rb_raise(rb_eArgError, "args must be an Array or a string with msgpack array");
+
+  field->key = key;
+  field->type = LWT_FIELD_MSGPACK;
+  field->val = args;
+  field->len = 0;
+}
+
+/*
+ * Any value encoded by the native encoder, strings must use lwt_field_str().
+ */
+static void
+lwt_field_value(lwt_field_t *field, int key, VALUE val) {
+  field->key = key;
+  field->type = LWT_FIELD_MSGPACK;
+  field->val = val;
+  field->len = 0;
+}
+
+/*
+ * Size of frame body, lengths of fields are set by it.
+ */
+static size_t
+lwt_conn_frame_len(int code, uint64_t reqid, lwt_field_t *fields, int count) {
+  int i;
+
+  size_t len = mp_sizeof_map(2) +
+               mp_sizeof_uint(TNT_CODE) + mp_sizeof_uint(code) +
+               mp_sizeof_uint(TNT_SYNC) + mp_sizeof_uint(reqid) +
+               mp_sizeof_map(count);
+
+  for (i = 0; i < count; i++) {
+    lwt_field_t *field = &fields[i];
+    len += mp_sizeof_uint(field->key);
+
+    switch (field->type) {
+      case LWT_FIELD_UINT:
+        len += mp_sizeof_uint(field->num);
+        break;
+      case LWT_FIELD_STR:
+        field->len = RSTRING_LEN(field->val);
+        len += mp_sizeof_str(field->len);
+        break;
+      default:
+        field->len = TYPE(field->val) == T_STRING ? lwt_conn_args_sizeof(field->val) : lwt_pack_sizeof(field->val);
+        len += field->len;
+    }
   }
 
-  if (rc == -1) {
-    tnt_reply_free(reply);
+  return len;
+}
+
+/*
+ * Encode a frame into send buffer.
+ *
+ * IPROTO header and body are written straight into the send buffer,
+ * msgpack fields are copied from the caller's string or encoded in place.
+ * Frame isn't sent until lwt_conn_flush().
+ */
+static void
+lwt_conn_put_frame(lwt_conn_t *conn, int code, uint64_t reqid, lwt_field_t *fields, int count) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  size_t len = lwt_conn_frame_len(code, reqid, fields, count);
+  size_t size = 5 + len;
+  int i;
+
+  if (size > sn->sbuf.size) {
+    sn->error = TNT_EBIG;
     lwt_conn_raise_error(conn);
   }
 
-  if (rc != 0) {
-    tnt_reply_free(reply);
-    rb_raise( lwt_eUnknownError, "read_reply() return code %d", rc);
+  // Flushing waits for the socket without GVL or in Fiber scheduler, so other
+  // threads may change the arguments meanwhile and they must be sized again.
+  // Nothing switches threads between the last sizing and encoding.
+  while (sn->sbuf.off + size > sn->sbuf.size) {
+    if (lwt_conn_reserve(conn, size) < 0)
+      lwt_conn_raise_error(conn);
+
+    len = lwt_conn_frame_len(code, reqid, fields, count);
+    size = 5 + len;
+
+    if (size > sn->sbuf.size) {
+      sn->error = TNT_EBIG;
+      lwt_conn_raise_error(conn);
+    }
   }
 
-  if (st_delete(conn->requests, &reply->sync, &req) != 1) {
-    int sync = reply->sync;
-    tnt_reply_free(reply);
-    rb_raise(lwt_eSyncError, "Bad sync id %lu in tarantool reply", sync);
+  char *data = sn->sbuf.buf + sn->sbuf.off;
+
+  data = mp_store_u8(data, 0xce);
+  data = mp_store_u32(data, len);
+
+  data = mp_encode_map(data, 2);
+  data = mp_encode_uint(data, TNT_CODE);
+  data = mp_encode_uint(data, code);
+  data = mp_encode_uint(data, TNT_SYNC);
+  data = mp_encode_uint(data, reqid);
+
+  data = mp_encode_map(data, count);
+
+  for (i = 0; i < count; i++) {
+    lwt_field_t *field = &fields[i];
+    data = mp_encode_uint(data, field->key);
+
+    switch (field->type) {
+      case LWT_FIELD_UINT:
+        data = mp_encode_uint(data, field->num);
+        break;
+      case LWT_FIELD_STR:
+        data = mp_encode_str(data, RSTRING_PTR(field->val), field->len);
+        break;
+      default:
+        if (TYPE(field->val) != T_STRING) {
+          data = lwt_pack_encode(data, field->val);
+        } else {
+          memcpy(data, RSTRING_PTR(field->val), field->len);
+          data += field->len;
+        }
+    }
   }
 
-  lwt_request_add_reply( req, reply);
+  sn->sbuf.off += size;
+}
+
+/*
+ * Encode a request into send buffer and register it.
+ */
+static VALUE
+lwt_conn_put_request(VALUE self, lwt_conn_t *conn, int code, lwt_field_t *fields, int count) {
+  uint64_t reqid = conn->tnt->reqid;
+
+  lwt_conn_put_frame(conn, code, reqid, fields, count);
+  conn->tnt->reqid++;
+  conn->tnt->wrcnt++;
+
+  VALUE req = lwt_request_create(self, reqid);
+  lwt_slots_insert(&conn->requests, reqid, req);
+
+  if (conn->requests.count > conn->in_flight_max)
+    conn->in_flight_max = conn->requests.count;
 
   return req;
 }
 
-/**
- * Document-class: LWTarantool::Connection
- *
- * Check if connection established.
- *
- * @example
- *   conn.connected?
- *
- * @return [Boolean]
- */
 static VALUE
-lwt_conn_is_connected(VALUE self) {
-  lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+lwt_conn_put_call(VALUE self, lwt_conn_t *conn, VALUE func, VALUE args) {
+  lwt_field_t fields[2];
 
-  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  lwt_field_str(&fields[0], TNT_FUNCTION, func, "function name");
+  lwt_field_msgpack(&fields[1], TNT_TUPLE, args);
 
-  if (sn->connected)
-    return Qtrue;
-  else
+  return lwt_conn_put_request(self, conn, TNT_OP_CALL, fields, 2);
+}
+
+/*
+ * Send buffered requests, or leave them corked.
+ *
+ * In corking mode requests stay in send buffer until it grows over
+ * cork_bytes, a reply is waited for or the flusher thread wakes up after
+ * cork window. Flusher is signalled once per corked batch.
+ */
+static void
+lwt_conn_commit(VALUE self, lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+
+  if (conn->cork_window == 0 || sn->sbuf.off >= conn->cork_bytes) {
+    if (lwt_conn_flush(conn) < 0)
+      lwt_conn_raise_error(conn);
+    return;
+  }
+
+  if (!conn->corked) {
+    conn->corked = 1;
+    rb_funcall(rb_ivar_get(self, rb_intern("@flush_signal")), rb_intern("push"), 1, Qtrue);
+  }
+}
+
+/*
+ * Encode a request and send it right away, unless it's corked.
+ */
+static VALUE
+lwt_conn_send_request(VALUE self, int code, lwt_field_t *fields, int count) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  VALUE req = lwt_conn_put_request(self, conn, code, fields, count);
+  lwt_conn_commit(self, conn);
+
+  return req;
+}
+
+static VALUE
+lwt_conn_call(VALUE self, VALUE func, VALUE args) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  VALUE req = lwt_conn_put_call(self, conn, func, args);
+  lwt_conn_commit(self, conn);
+
+  return req;
+}
+
+/*
+ * Send corked requests.
+ */
+static VALUE
+lwt_conn_flush_m(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  return Qnil;
+}
+
+static VALUE
+lwt_conn_select(VALUE self, VALUE space, VALUE index, VALUE key, VALUE iterator, VALUE limit, VALUE offset) {
+  lwt_field_t fields[6];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_uint(&fields[1], TNT_INDEX, index, "index id");
+  lwt_field_uint(&fields[2], TNT_LIMIT, limit, "limit");
+  lwt_field_uint(&fields[3], TNT_OFFSET, offset, "offset");
+  lwt_field_uint(&fields[4], TNT_ITERATOR, iterator, "iterator");
+  lwt_field_msgpack(&fields[5], TNT_KEY, key);
+
+  return lwt_conn_send_request(self, TNT_OP_SELECT, fields, 6);
+}
+
+static VALUE
+lwt_conn_insert(VALUE self, VALUE space, VALUE tuple) {
+  lwt_field_t fields[2];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_msgpack(&fields[1], TNT_TUPLE, tuple);
+
+  return lwt_conn_send_request(self, TNT_OP_INSERT, fields, 2);
+}
+
+static VALUE
+lwt_conn_replace(VALUE self, VALUE space, VALUE tuple) {
+  lwt_field_t fields[2];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_msgpack(&fields[1], TNT_TUPLE, tuple);
+
+  return lwt_conn_send_request(self, TNT_OP_REPLACE, fields, 2);
+}
+
+static VALUE
+lwt_conn_update(VALUE self, VALUE space, VALUE index, VALUE key, VALUE ops) {
+  lwt_field_t fields[4];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_uint(&fields[1], TNT_INDEX, index, "index id");
+  lwt_field_msgpack(&fields[2], TNT_KEY, key);
+  lwt_field_msgpack(&fields[3], TNT_TUPLE, ops);
+
+  return lwt_conn_send_request(self, TNT_OP_UPDATE, fields, 4);
+}
+
+static VALUE
+lwt_conn_upsert(VALUE self, VALUE space, VALUE tuple, VALUE ops) {
+  lwt_field_t fields[3];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_msgpack(&fields[1], TNT_TUPLE, tuple);
+  lwt_field_msgpack(&fields[2], TNT_OPS, ops);
+
+  return lwt_conn_send_request(self, TNT_OP_UPSERT, fields, 3);
+}
+
+static VALUE
+lwt_conn_delete(VALUE self, VALUE space, VALUE index, VALUE key) {
+  lwt_field_t fields[3];
+
+  lwt_field_uint(&fields[0], TNT_SPACE, space, "space id");
+  lwt_field_uint(&fields[1], TNT_INDEX, index, "index id");
+  lwt_field_msgpack(&fields[2], TNT_KEY, key);
+
+  return lwt_conn_send_request(self, TNT_OP_DELETE, fields, 3);
+}
+
+static VALUE
+lwt_conn_execute(VALUE self, VALUE sql, VALUE binds) {
+  lwt_field_t fields[2];
+
+  lwt_field_str(&fields[0], TNT_SQL_TEXT, sql, "SQL statement");
+  lwt_field_msgpack(&fields[1], TNT_SQL_BIND, binds);
+
+  return lwt_conn_send_request(self, TNT_OP_EXECUTE, fields, 2);
+}
+
+static VALUE
+lwt_conn_call_many_put(VALUE args) {
+  VALUE self = rb_ary_entry(args, 0);
+  VALUE calls = rb_ary_entry(args, 1);
+  VALUE reqs = rb_ary_entry(args, 2);
+
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  long i;
+  for (i = 0; i < RARRAY_LEN(calls); i++) {
+    VALUE call = rb_ary_entry(calls, i);
+
+    if (TYPE(call) != T_ARRAY || RARRAY_LEN(call) != 2)
+      rb_raise(rb_eArgError, "call must be an Array of function name and args");
+
+    rb_ary_push(reqs, lwt_conn_put_call(self, conn, rb_ary_entry(call, 0), rb_ary_entry(call, 1)));
+  }
+
+  return reqs;
+}
+
+static VALUE
+lwt_conn_call_many_flush(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  return Qnil;
+}
+
+/*
+ * Fail a request waiting for reply with timeout error.
+ *
+ * Its sync id stays reserved, so a late reply is dropped.
+ * Returns false if request is already processed.
+ */
+static VALUE
+lwt_conn_abandon(VALUE self, VALUE req) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  if (lwt_slots_abandon(&conn->requests, lwt_request_sync(req)) == Qundef)
     return Qfalse;
+
+  lwt_conn_fail_request(req, "Request timed out");
+
+  return Qtrue;
+}
+
+/*
+ * Encode all calls into send buffer and send them at once.
+ *
+ * Already encoded requests are sent even if encoding of a next one fails.
+ */
+static VALUE
+lwt_conn_call_many(VALUE self, VALUE calls) {
+  if (TYPE(calls) != T_ARRAY)
+    rb_raise(rb_eArgError, "calls must be an Array");
+
+  VALUE reqs = rb_ary_new_capa(RARRAY_LEN(calls));
+  VALUE args = rb_ary_new_from_args(3, self, calls, reqs);
+
+  rb_ensure(lwt_conn_call_many_put, args, lwt_conn_call_many_flush, self);
+
+  return reqs;
+}
+
+// Weight of the last reply in latency moving average
+#define LWT_LATENCY_WEIGHT 0.05
+
+static void
+lwt_conn_count_reply(lwt_conn_t *conn, VALUE req) {
+  double latency = lwt_clock() - lwt_request_sent_at(req);
+
+  lwt_request_set_latency(req, latency);
+  lwt_histogram_record(&conn->latency, latency);
+
+  if (conn->replies++ == 0)
+    conn->latency_avg = latency;
+  else
+    conn->latency_avg += (latency - conn->latency_avg) * LWT_LATENCY_WEIGHT;
+}
+
+// IPROTO_SQL_INFO, vendored tnt_proto.h has a value of early SQL versions
+#define LWT_SQL_INFO 0x42
+
+/*
+ * Find SQL info of a reply, tnt_reply0() doesn't know its current key.
+ */
+static void
+lwt_conn_find_sqlinfo(struct tnt_reply *reply, const char *frame) {
+  const char *p = frame;
+  uint32_t n;
+
+  mp_next(&p); // frame length
+  mp_next(&p); // header
+  if (mp_typeof(*p) != MP_MAP)
+    return;
+
+  n = mp_decode_map(&p);
+  while (n-- > 0) {
+    uint64_t key = mp_typeof(*p) == MP_UINT ? mp_decode_uint(&p) : (mp_next(&p), 0);
+
+    if (key == LWT_SQL_INFO && mp_typeof(*p) == MP_MAP) {
+      reply->sqlinfo = p;
+      mp_next(&p);
+      reply->sqlinfo_end = p;
+      return;
+    }
+
+    mp_next(&p);
+  }
+}
+
+/*
+ * Move reply out of receive buffer.
+ *
+ * Reply body is copied into a pool buffer and reply pointers are moved
+ * there. Replies without body don't need a buffer at all.
+ */
+static void
+lwt_conn_keep_reply(lwt_conn_t *conn, struct tnt_reply *reply, const char *frame, size_t len) {
+  const char *start = NULL, *end = NULL;
+  const char **ptrs[] = {
+    &reply->error, &reply->error_end, &reply->data, &reply->data_end,
+    &reply->metadata, &reply->metadata_end, &reply->sqlinfo, &reply->sqlinfo_end,
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++) {
+    const char *p = *ptrs[i];
+    if (p == NULL || p < frame || p > frame + len)
+      continue;
+    if (start == NULL || p < start)
+      start = p;
+    if (end == NULL || p > end)
+      end = p;
+  }
+
+  if (start == NULL || start == end)
+    return;
+
+  char *buf = lwt_pool_alloc(conn->pool, end - start);
+  memcpy(buf, start, end - start);
+
+  for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++) {
+    if (*ptrs[i] != NULL)
+      *ptrs[i] = buf + (*ptrs[i] - start);
+  }
+
+  reply->buf = buf;
+  reply->buf_size = end - start;
+}
+
+/*
+ * Dispatch a reply buffered at rbuf head to its request.
+ *
+ * Reply is parsed in place, its body is moved to a pool buffer.
+ * Returns the request or LWT_SLOT_ABANDONED for a late reply of
+ * a timed out request.
+ */
+static VALUE
+lwt_conn_take_reply(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *rbuf = &sn->rbuf;
+  struct tnt_reply reply;
+  const char *frame = rbuf->buf + rbuf->off;
+  size_t len;
+  VALUE req;
+
+  tnt_reply_init(&reply);
+  if (tnt_reply0(&reply, frame, rbuf->top - rbuf->off, &len) != 0)
+    rb_raise(lwt_eUnknownError, "Bad tarantool reply");
+
+  rbuf->off += len;
+  conn->tnt->wrcnt--;
+
+  if (reply.schema_id > conn->schema_seen)
+    conn->schema_seen = reply.schema_id;
+
+  if (reply.code == TNT_ER_WRONG_SCHEMA_VERSION)
+    conn->schema_id = 0;
+
+  // nobody waits for pipelined auth, caller closes connection if it failed
+  if (conn->auth_pending && reply.sync == conn->auth_sync) {
+    conn->auth_pending = 0;
+
+    if (reply.code != 0) {
+      VALUE error = reply.error ? rb_str_new(reply.error, reply.error_end - reply.error) : rb_str_new_cstr("Authentication failed");
+      rb_exc_raise(rb_exc_new_str(lwt_eLoginError, error));
+    }
+
+    return LWT_SLOT_ABANDONED;
+  }
+
+  req = lwt_slots_delete(&conn->requests, reply.sync);
+  if (req == Qundef)
+    rb_raise(lwt_eSyncError, "Bad sync id %lu in tarantool reply", (unsigned long)reply.sync);
+
+  if (req == LWT_SLOT_ABANDONED)
+    return req;
+
+  // only SQL DML replies have neither data nor error
+  if (reply.code == 0 && reply.data == NULL && reply.sqlinfo == NULL)
+    lwt_conn_find_sqlinfo(&reply, frame);
+
+  lwt_conn_keep_reply(conn, &reply, frame, len);
+  lwt_conn_count_reply(conn, req);
+  lwt_request_add_reply( req, &reply, reply.buf ? conn->pool : NULL);
+
+  return req;
+}
+
+/*
+ * Timeout of _read wait argument: nil or true waits infinitely,
+ * false doesn't wait at all.
+ */
+static double
+lwt_conn_read_timeout(VALUE wait) {
+  if (wait == Qfalse)
+    return 0;
+  if (NIL_P(wait) || wait == Qtrue)
+    return -1;
+  return NUM2DBL(wait);
+}
+
+static VALUE
+lwt_conn_read(int argc, VALUE *argv, VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  VALUE req, wait;
+
+  rb_scan_args(argc, argv, "01", &wait);
+
+  double timeout = lwt_conn_read_timeout(wait);
+  double deadline = lwt_clock() + timeout;
+
+  // corked requests are sent once their replies are waited for
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  while (1) {
+    // nothing was sent, so nothing to read
+    if (conn->tnt->wrcnt == 0)
+      return Qnil;
+
+    double left = timeout;
+    if (timeout > 0) {
+      left = deadline - lwt_clock();
+      if (left < 0)
+        left = 0;
+    }
+
+    switch (lwt_conn_fill(conn, left)) {
+      case 0:
+        break;
+      case 1:
+        return ID2SYM(rb_intern("wait_readable"));
+      default:
+        lwt_conn_raise_error(conn);
+    }
+
+    req = lwt_conn_take_reply(conn);
+
+    // late reply of a timed out request
+    if (req != LWT_SLOT_ABANDONED)
+      return req;
+  }
+}
+
+// Receive buffer size for draining many replies with a single recv
+#define LWT_READ_ALL_BUF_SIZE (256 * 1024)
+
+/*
+ * Make the whole receive buffer free for the next recv.
+ */
+static void
+lwt_conn_prepare_rbuf(lwt_conn_t *conn) {
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *rbuf = &sn->rbuf;
+  size_t avail = rbuf->top - rbuf->off;
+
+  if (rbuf->size < LWT_READ_ALL_BUF_SIZE) {
+    char *buf = tnt_mem_realloc(rbuf->buf, LWT_READ_ALL_BUF_SIZE);
+    if (buf == NULL)
+      rb_raise(rb_eNoMemError, "failed to allocate receive buffer");
+    rbuf->buf = buf;
+    rbuf->size = LWT_READ_ALL_BUF_SIZE;
+  }
+
+  if (rbuf->off > 0) {
+    memmove(rbuf->buf, rbuf->buf + rbuf->off, avail);
+    rbuf->off = 0;
+    rbuf->top = avail;
+  }
+}
+
+/*
+ * Dispatch every complete reply already received.
+ *
+ * Waits like _read until at least one reply is received, then replies
+ * buffered by the same recv are dispatched without further syscalls.
+ * Returns an Array of requests, or :wait_readable if nothing is received
+ * in time.
+ */
+static VALUE
+lwt_conn_read_all(int argc, VALUE *argv, VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  VALUE req, wait, reqs = rb_ary_new();
+
+  rb_scan_args(argc, argv, "01", &wait);
+
+  double timeout = lwt_conn_read_timeout(wait);
+  double deadline = lwt_clock() + timeout;
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *rbuf = &sn->rbuf;
+  size_t need;
+
+  if (conn->tnt->wrcnt == 0)
+    return reqs;
+
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  if (tnt_reply(NULL, rbuf->buf + rbuf->off, rbuf->top - rbuf->off, &need) != 0)
+    lwt_conn_prepare_rbuf(conn);
+
+  while (conn->tnt->wrcnt > 0) {
+    if (RARRAY_LEN(reqs) > 0) {
+      if (tnt_reply(NULL, rbuf->buf + rbuf->off, rbuf->top - rbuf->off, &need) != 0)
+        break;
+    } else {
+      double left = timeout;
+      if (timeout > 0) {
+        left = deadline - lwt_clock();
+        if (left < 0)
+          left = 0;
+      }
+
+      switch (lwt_conn_fill(conn, left)) {
+        case 0:
+          break;
+        case 1:
+          return ID2SYM(rb_intern("wait_readable"));
+        default:
+          lwt_conn_raise_error(conn);
+      }
+    }
+
+    req = lwt_conn_take_reply(conn);
+    if (req != LWT_SLOT_ABANDONED)
+      rb_ary_push(reqs, req);
+  }
+
+  return reqs;
+}
+
+/*
+ * Replication.
+ *
+ * After SUBSCRIBE the connection carries a stream of rows instead of
+ * replies, so they are read by _next_row bypassing the request table.
+ * Rows are waited for without GVL like replies.
+ */
+
+// IPROTO keys and codes missing in the vendored tnt_proto.h
+#define LWT_IPROTO_OK 0
+#define LWT_IPROTO_TYPE_ERROR 0x8000
+#define LWT_IPROTO_REPLICA_ANON 0x50
+
+static VALUE
+lwt_conn_subscribe(VALUE self, VALUE instance_uuid, VALUE replicaset_uuid, VALUE vclock, VALUE anon) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  lwt_field_t fields[4] = {{0}};
+  int count = 3;
+
+  Check_Type(vclock, T_HASH);
+
+  lwt_field_str(&fields[0], TNT_SERVER_UUID, instance_uuid, "instance uuid");
+  lwt_field_str(&fields[1], TNT_CLUSTER_UUID, replicaset_uuid, "replicaset uuid");
+  lwt_field_value(&fields[2], TNT_VCLOCK, vclock);
+  if (RTEST(anon))
+    lwt_field_value(&fields[count++], LWT_IPROTO_REPLICA_ANON, Qtrue);
+
+  // rows bypass reply dispatching, so auth reply is taken before them
+  while (conn->auth_pending) {
+    if (lwt_conn_fill(conn, -1) < 0)
+      lwt_conn_raise_error(conn);
+    lwt_conn_take_reply(conn);
+  }
+
+  lwt_conn_put_frame(conn, TNT_OP_SUBSCRIBE, conn->tnt->reqid++, fields, count);
+
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  return Qnil;
+}
+
+/*
+ * Report replica vclock to master, it also keeps relay from timing out.
+ */
+static VALUE
+lwt_conn_ack(VALUE self, VALUE vclock) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  lwt_field_t field;
+
+  Check_Type(vclock, T_HASH);
+  lwt_field_value(&field, TNT_VCLOCK, vclock);
+
+  lwt_conn_put_frame(conn, LWT_IPROTO_OK, 0, &field, 1);
+
+  if (lwt_conn_flush(conn) < 0)
+    lwt_conn_raise_error(conn);
+
+  return Qnil;
+}
+
+/*
+ * Read the next row of replication stream.
+ *
+ * vclock is advanced by every row, including heartbeats and rows of
+ * filtered out spaces.
+ *
+ * Returns a row Hash, true for a row which isn't yielded or nil on timeout.
+ */
+static VALUE
+lwt_conn_next_row(VALUE self, VALUE timeout, VALUE vclock, VALUE filter, VALUE symbolize_keys, VALUE freeze) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+  struct tnt_iob *rbuf = &sn->rbuf;
+  int flags = 0;
+
+  Check_Type(vclock, T_HASH);
+  lwt_xrow_check_filter(filter);
+
+  if (RTEST(symbolize_keys))
+    flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    flags |= LWT_UNPACK_FREEZE;
+
+  switch (lwt_conn_fill(conn, NIL_P(timeout) ? -1 : NUM2DBL(timeout))) {
+    case 0:
+      break;
+    case 1:
+      return Qnil;
+    default:
+      lwt_conn_raise_error(conn);
+  }
+
+  const char *frame = rbuf->buf + rbuf->off;
+  size_t len;
+
+  if (tnt_reply(NULL, rbuf->buf + rbuf->off, rbuf->top - rbuf->off, &len) != 0)
+    rb_raise(lwt_eUnknownError, "Bad replication row");
+
+  // the row stays in rbuf until the next read, so it is consumed right away
+  rbuf->off += len;
+
+  const char *end = frame + len;
+  const char *pos = frame;
+  const char *check;
+  lwt_xrow_t row;
+
+  mp_decode_uint(&pos);
+
+  check = pos;
+  if (pos >= end || mp_typeof(*pos) != MP_MAP || mp_check(&check, end) != 0)
+    rb_raise(lwt_eUnknownError, "Bad replication row");
+
+  pos = lwt_xrow_decode_header(&row, pos);
+
+  if (pos < end) {
+    check = pos;
+    if (mp_check(&check, end) != 0)
+      rb_raise(lwt_eUnknownError, "Bad replication row");
+    lwt_xrow_decode_body(&row, pos);
+  }
+
+  if (row.type & LWT_IPROTO_TYPE_ERROR) {
+    uint32_t msg_len = 0;
+    const char *msg = "";
+
+    if (row.error != NULL && mp_typeof(*row.error) == MP_STR)
+      msg = mp_decode_str(&row.error, &msg_len);
+
+    rb_raise(lwt_eError, "%.*s", (int)msg_len, msg);
+  }
+
+  if (row.lsn > 0)
+    rb_hash_aset(vclock, ULL2NUM(row.replica_id), ULL2NUM(row.lsn));
+
+  // heartbeats, subscribe response and NOPs aren't data changes
+  if (row.type == LWT_IPROTO_OK || row.type == LWT_XROW_NOP || !lwt_xrow_match(&row, filter))
+    return Qtrue;
+
+  return lwt_xrow_to_hash(&row, flags);
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Check if connection established.
+ *
+ * @example
+ *   conn.connected?
+ *
+ * @return [Boolean]
+ */
+static VALUE
+lwt_conn_is_connected(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+
+  if (sn->connected)
+    return Qtrue;
+  else
+    return Qfalse;
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * IO object for connection socket.
+ *
+ * Useful to wait for connection events in an event loop.
+ * The IO doesn't own the socket, so don't read, write or close it.
+ *
+ * @example
+ *   conn.io.wait_readable
+ *
+ * @return [IO] socket IO.
+ * @return [nil] nil if connection is not established.
+ */
+static VALUE
+lwt_conn_io(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  struct tnt_stream_net *sn = TNT_SNET_CAST(conn->tnt);
+
+  if (!sn->connected)
+    return Qnil;
+
+  return lwt_conn_get_io(conn);
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Check if connection uses non-blocking mode.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+lwt_conn_is_nonblock(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return conn->nonblock ? Qtrue : Qfalse;
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Check if connection uses multiplexed mode.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+lwt_conn_is_multiplex(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return conn->multiplex ? Qtrue : Qfalse;
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Get encoder of function arguments.
+ *
+ * @return [Symbol] :msgpack or :native.
+ */
+static VALUE
+lwt_conn_encoder(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return ID2SYM(rb_intern(conn->native_encoder ? "native" : "msgpack"));
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Get count of requests waiting for reply.
+ *
+ * Timed out requests aren't counted, though their late replies are
+ * still expected.
+ *
+ * @return [Integer]
+ */
+static VALUE
+lwt_conn_in_flight(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return SIZET2NUM(conn->requests.count - conn->requests.abandoned);
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Get connection statistics.
+ *
+ * @example
+ *   conn.stats[:pool_hit_rate]
+ *
+ * @return [Hash] statistics:
+ *   :in_flight - count of requests waiting for reply, except timed out ones,
+ *   :replies - count of received replies,
+ *   :latency_avg - moving average of reply latency in seconds,
+ *   :latency_p50, :latency_p90, :latency_p99, :latency_p999, :latency_max - reply
+ *   latency percentiles in seconds,
+ *   :bytes_sent, :bytes_received - traffic of the connection,
+ *   :send_calls, :recv_calls - count of send and recv syscalls,
+ *   :replies_per_recv - average count of replies got by one recv which got data,
+ *   :in_flight_max - high-water mark of requests waiting for reply,
+ *   :lock_wait_time - seconds threads spent waiting for the connection lock,
+ *   :failovers - count of standby connections taken over,
+ *   :schema_id - version of cached schema, 0 if it isn't loaded,
+ *   :pool_hits, :pool_misses, :pool_hit_rate - reply buffer pool usage,
+ *   :pool_cached_bytes - size of free buffers kept in pool,
+ *   :pool_buffers_in_use - reply buffers held by requests,
+ *   :call_cache_hits, :call_cache_misses, :call_coalesced, :call_cache_evictions,
+ *   :call_cache_entries, :call_cache_bytes - idempotent calls cache usage
+ *   if it is enabled.
+ */
+static VALUE
+lwt_conn_stats(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, ID2SYM(rb_intern("in_flight")), SIZET2NUM(conn->requests.count - conn->requests.abandoned));
+  rb_hash_aset(stats, ID2SYM(rb_intern("replies")), ULL2NUM(conn->replies));
+  rb_hash_aset(stats, ID2SYM(rb_intern("latency_avg")), DBL2NUM(conn->latency_avg));
+  rb_hash_aset(stats, ID2SYM(rb_intern("schema_id")), ULL2NUM(conn->schema_id));
+  lwt_histogram_stats(&conn->latency, "latency", stats);
+  rb_hash_aset(stats, ID2SYM(rb_intern("bytes_sent")), ULL2NUM(conn->bytes_sent));
+  rb_hash_aset(stats, ID2SYM(rb_intern("bytes_received")), ULL2NUM(conn->bytes_received));
+  rb_hash_aset(stats, ID2SYM(rb_intern("send_calls")), ULL2NUM(conn->send_calls));
+  rb_hash_aset(stats, ID2SYM(rb_intern("recv_calls")), ULL2NUM(conn->recv_calls));
+  rb_hash_aset(stats, ID2SYM(rb_intern("replies_per_recv")),
+               DBL2NUM(conn->recv_data_calls ? (double)conn->replies / conn->recv_data_calls : 0.0));
+  rb_hash_aset(stats, ID2SYM(rb_intern("in_flight_max")), SIZET2NUM(conn->in_flight_max));
+  rb_hash_aset(stats, ID2SYM(rb_intern("lock_wait_time")), rb_ivar_get(self, rb_intern("@lock_wait_time")));
+  rb_hash_aset(stats, ID2SYM(rb_intern("failovers")), ULL2NUM(conn->failovers));
+  lwt_pool_stats(conn->pool, stats);
+
+  VALUE cache = rb_ivar_get(self, rb_intern("@call_cache"));
+  if (!NIL_P(cache))
+    rb_funcall(cache, rb_intern("fill_stats"), 1, stats);
+
+  return stats;
+}
+
+/**
+ * Document-class: LWTarantool::Connection
+ *
+ * Get reply latency histogram of the connection.
+ *
+ * @example
+ *   conn.latency.percentile(99.9)
+ *
+ * @return [LWTarantool::Histogram] a copy of the histogram.
+ */
+static VALUE
+lwt_conn_latency(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return lwt_histogram_dup(&conn->latency);
+}
+
+/*
+ * Check if cached schema has to be (re)loaded.
+ *
+ * Schema is outdated when a reply brings a newer schema version
+ * or a request fails with ER_WRONG_SCHEMA_VERSION.
+ */
+static VALUE
+lwt_conn_schema_outdated(VALUE self) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  return (conn->schema_id == 0 || conn->schema_seen > conn->schema_id) ? Qtrue : Qfalse;
+}
+
+static const struct tnt_reply *
+lwt_conn_schema_reply(VALUE req) {
+  const struct tnt_reply *reply = lwt_request_reply(req);
+
+  if (reply == NULL)
+    rb_raise(lwt_eSchemaError, "Schema request isn't processed");
+
+  if (reply->code != 0)
+    rb_raise(lwt_eSchemaError, "Can't load schema: %.*s",
+             (int)(reply->error_end - reply->error), reply->error);
+
+  return reply;
+}
+
+/*
+ * Replace cached schema with _vspace and _vindex select results.
+ */
+static VALUE
+lwt_conn_load_schema(VALUE self, VALUE spaces, VALUE indexes) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  struct tnt_schema *schema = TNT_SNET_CAST(conn->tnt)->schema;
+  const struct tnt_reply *sr = lwt_conn_schema_reply(spaces);
+  const struct tnt_reply *ir = lwt_conn_schema_reply(indexes);
+
+  conn->schema_id = 0;
+  tnt_schema_flush(schema);
+
+  if (tnt_schema_add_spaces(schema, (struct tnt_reply *)sr) < 0 ||
+      tnt_schema_add_indexes(schema, (struct tnt_reply *)ir) < 0)
+    rb_raise(lwt_eSchemaError, "Bad schema reply");
+
+  // replies may come from different versions if schema was changed in between,
+  // then the older one is kept, so schema is loaded again
+  conn->schema_id = sr->schema_id < ir->schema_id ? sr->schema_id : ir->schema_id;
+  if (conn->schema_id == 0)
+    conn->schema_id = 1;
+
+  return Qnil;
+}
+
+static VALUE
+lwt_conn_space_id(VALUE self, VALUE name) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  Check_Type(name, T_STRING);
+
+  int32_t id = tnt_schema_stosid(TNT_SNET_CAST(conn->tnt)->schema, RSTRING_PTR(name), RSTRING_LEN(name));
+
+  return id < 0 ? Qnil : INT2NUM(id);
+}
+
+static VALUE
+lwt_conn_index_id(VALUE self, VALUE space, VALUE name) {
+  lwt_conn_t * conn;
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
+
+  Check_Type(name, T_STRING);
+
+  int32_t id = tnt_schema_stoiid(TNT_SNET_CAST(conn->tnt)->schema, NUM2UINT(space), RSTRING_PTR(name), RSTRING_LEN(name));
+
+  return id < 0 ? Qnil : INT2NUM(id);
 }
 
 static VALUE
 lwt_conn_error(VALUE self) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
 
   return rb_uint2inum(tnt_error(conn->tnt));
 }
@@ -339,7 +2100,7 @@ lwt_conn_error(VALUE self) {
 static VALUE
 lwt_conn_errno(VALUE self) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
 
   return rb_uint2inum(tnt_errno(conn->tnt));
 }
@@ -347,7 +2108,7 @@ lwt_conn_errno(VALUE self) {
 static VALUE
 lwt_conn_strerror(VALUE self) {
   lwt_conn_t * conn;
-  Data_Get_Struct(self, lwt_conn_t, conn);
+  TypedData_Get_Struct(self, lwt_conn_t, &lwt_conn_type, conn);
 
   return rb_str_new_cstr(tnt_strerror(conn->tnt));
 }
@@ -371,15 +2132,43 @@ void init_conn() {
   rb_const_set( lwt_Class, rb_intern("TNT_ELOGIN"), rb_uint2inum(TNT_ELOGIN));
 
   rb_define_attr(cClass, "url", 1, 0);
+  rb_define_attr(cClass, "timeout", 1, 0);
   rb_define_alloc_func(cClass, lwt_conn_alloc);
   rb_define_method(cClass, "initialize", lwt_conn_initialize, 1);
   rb_define_private_method(cClass, "_connect", lwt_conn_connect, 0);
   rb_define_private_method(cClass, "_disconnect", lwt_conn_disconnect, 0);
+  rb_define_private_method(cClass, "_hand_over", lwt_conn_hand_over, 1);
   rb_define_private_method(cClass, "_error", lwt_conn_error, 0);
   rb_define_private_method(cClass, "_errno", lwt_conn_errno, 0);
   rb_define_private_method(cClass, "_strerror", lwt_conn_strerror, 0);
   rb_define_private_method(cClass, "_call", lwt_conn_call, 2);
-  rb_define_private_method(cClass, "_read", lwt_conn_read, 0);
+  rb_define_private_method(cClass, "_call_many", lwt_conn_call_many, 1);
+  rb_define_private_method(cClass, "_pack", lwt_conn_pack, 1);
+  rb_define_private_method(cClass, "_select", lwt_conn_select, 6);
+  rb_define_private_method(cClass, "_insert", lwt_conn_insert, 2);
+  rb_define_private_method(cClass, "_replace", lwt_conn_replace, 2);
+  rb_define_private_method(cClass, "_update", lwt_conn_update, 4);
+  rb_define_private_method(cClass, "_upsert", lwt_conn_upsert, 3);
+  rb_define_private_method(cClass, "_delete", lwt_conn_delete, 3);
+  rb_define_private_method(cClass, "_execute", lwt_conn_execute, 2);
+  rb_define_private_method(cClass, "_schema_outdated?", lwt_conn_schema_outdated, 0);
+  rb_define_private_method(cClass, "_load_schema", lwt_conn_load_schema, 2);
+  rb_define_private_method(cClass, "_space_id", lwt_conn_space_id, 1);
+  rb_define_private_method(cClass, "_index_id", lwt_conn_index_id, 2);
+  rb_define_private_method(cClass, "_flush", lwt_conn_flush_m, 0);
+  rb_define_private_method(cClass, "_read", lwt_conn_read, -1);
+  rb_define_private_method(cClass, "_read_all", lwt_conn_read_all, -1);
+  rb_define_private_method(cClass, "_abandon", lwt_conn_abandon, 1);
+  rb_define_private_method(cClass, "_subscribe", lwt_conn_subscribe, 4);
+  rb_define_private_method(cClass, "_ack", lwt_conn_ack, 1);
+  rb_define_private_method(cClass, "_next_row", lwt_conn_next_row, 5);
 
   rb_define_method(cClass, "connected?", lwt_conn_is_connected, 0);
+  rb_define_method(cClass, "nonblock?", lwt_conn_is_nonblock, 0);
+  rb_define_method(cClass, "multiplex?", lwt_conn_is_multiplex, 0);
+  rb_define_method(cClass, "encoder", lwt_conn_encoder, 0);
+  rb_define_method(cClass, "stats", lwt_conn_stats, 0);
+  rb_define_method(cClass, "latency", lwt_conn_latency, 0);
+  rb_define_method(cClass, "in_flight", lwt_conn_in_flight, 0);
+  rb_define_method(cClass, "io", lwt_conn_io, 0);
 }
@@ -4,6 +4,7 @@
 VALUE lwt_eError = NULL;
 VALUE lwt_eLoginError = NULL;
 VALUE lwt_eResolvError = NULL;
+VALUE lwt_eSchemaError = Qnil;
 VALUE lwt_eSyncError = NULL;
 VALUE lwt_eSystemError = NULL;
 VALUE lwt_eTimeoutError = NULL;
@@ -16,6 +17,7 @@ void init_errors() {
   lwt_eSyncError = rb_define_class_under( lwt_Class, "SyncError", lwt_eError);
   lwt_eSystemError = rb_define_class_under( lwt_Class, "SystemError", lwt_eError);
   lwt_eResolvError = rb_define_class_under( lwt_Class, "ResolvError", lwt_eError);
+  lwt_eSchemaError = rb_define_class_under( lwt_Class, "SchemaError", lwt_eError);
   lwt_eTimeoutError = rb_define_class_under( lwt_Class, "TimeoutError", lwt_eError);
   lwt_eTooLargeRequestError = rb_define_class_under( lwt_Class, "TooLargeRequestError", lwt_eError);
   lwt_eUnknownError = rb_define_class_under( lwt_Class, "UnknownError", lwt_eError);
@@ -1,6 +1,18 @@
 require 'mkmf'
 
 $INCFLAGS << ' -I$(srcdir)/vendor/tarantool-c/include'
+$INCFLAGS << ' -I$(srcdir)/vendor/msgpuck'
+$INCFLAGS << ' -I$(srcdir)/vendor/tarantool-c/third_party'
+
+have_header('ruby/fiber/scheduler.h')
+have_func('rb_fiber_scheduler_address_resolve', 'ruby/fiber/scheduler.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
+have_func('rb_ext_ractor_safe', 'ruby.h')
+
+# compressed xlog transactions
+have_library('zstd', 'ZSTD_decompressStream', 'zstd.h') && have_header('zstd.h')
+
+# vendored libraries are built by depend, so they can't be linked into checks above
 $LIBPATH << 'msgpuck/'
 $LIBPATH << 'tarantool-c/tnt/'
 $LOCAL_LIBS = '-ltarantool -lmsgpuck'
@@ -4,9 +4,18 @@
 VALUE lwt_Class;
 
 void Init_lwtarantool() {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  // connections and requests are per Ractor, replies are frozen and shareable
+  rb_ext_ractor_safe(true);
+#endif
+
   lwt_Class = rb_define_module( "LWTarantool");
 
   init_errors();
   init_conn();
   init_request();
+  init_reply();
+  init_unpack();
+  init_xlog();
+  init_metrics();
 }
@@ -1,4 +1,5 @@
 #include <ruby.h>
+#include <time.h>
 #include <tarantool/tnt_reply.h>
 #include <tarantool/tnt_stream.h>
 
@@ -7,11 +8,23 @@
 #  define ZALLOC(type) (ZALLOC_N(type,1))
 #endif
 
+// Upper bound of iproto length prefix, header and body keys size
+#define LWT_REQUEST_OVERHEAD 64
+
 extern VALUE lwt_Class;
 
+// Monotonic time in seconds
+static inline double
+lwt_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 extern VALUE lwt_eError;
 extern VALUE lwt_eLoginError;
 extern VALUE lwt_eResolvError;
+extern VALUE lwt_eSchemaError;
 extern VALUE lwt_eSyncError;
 extern VALUE lwt_eSystemError;
 extern VALUE lwt_eTimeoutError;
@@ -19,21 +32,151 @@ extern VALUE lwt_eTooLargeRequestError;
 extern VALUE lwt_eUnknownError;
 
 
+// Reply buffer pool size classes: 256 bytes .. 64 KB
+#define LWT_POOL_CLASSES 9
+
+typedef struct lwt_pool lwt_pool_t;
+
+lwt_pool_t *lwt_pool_new(void);
+void lwt_pool_close(lwt_pool_t *pool);
+char *lwt_pool_alloc(lwt_pool_t *pool, size_t size);
+void lwt_pool_free(lwt_pool_t *pool, char *buf, size_t size);
+void lwt_pool_detach(lwt_pool_t *pool);
+void lwt_pool_stats(lwt_pool_t *pool, VALUE hash);
+
+// Latency histogram: 16 buckets per power of two up to 2^40 microseconds
+#define LWT_HIST_SUB_BITS 4
+#define LWT_HIST_MAX_EXP 40
+#define LWT_HIST_BUCKETS ((LWT_HIST_MAX_EXP - LWT_HIST_SUB_BITS + 2) << LWT_HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[LWT_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;         // microseconds
+    double sum;           // seconds
+} lwt_histogram_t;
+
+void lwt_histogram_record(lwt_histogram_t *hist, double seconds);
+double lwt_histogram_percentile(const lwt_histogram_t *hist, double percentile);
+void lwt_histogram_stats(const lwt_histogram_t *hist, const char *prefix, VALUE hash);
+VALUE lwt_histogram_dup(const lwt_histogram_t *hist);
+
+typedef struct {
+    uint64_t sync;
+    VALUE req;      // 0 for empty slot
+} lwt_slot_t;
+
+// Slot of a timed out request, which reply should be dropped
+#define LWT_SLOT_ABANDONED Qtrue
+
 typedef struct {
-    VALUE mutex;
+    lwt_slot_t *ring;
+    size_t size;    // power of two
+    uint64_t head;  // the oldest pending sync id
+    uint64_t tail;  // next after the newest pending sync id
+    size_t count;
+    size_t abandoned; // slots of timed out requests, included into count
+} lwt_slots_t;
+
+void lwt_slots_init(lwt_slots_t *slots);
+void lwt_slots_free(lwt_slots_t *slots);
+void lwt_slots_insert(lwt_slots_t *slots, uint64_t sync, VALUE req);
+VALUE lwt_slots_delete(lwt_slots_t *slots, uint64_t sync);
+VALUE lwt_slots_abandon(lwt_slots_t *slots, uint64_t sync);
+void lwt_slots_clear(lwt_slots_t *slots, void (*func)(VALUE req));
+void lwt_slots_mark(lwt_slots_t *slots);
+void lwt_slots_compact(lwt_slots_t *slots);
+size_t lwt_slots_memsize(const lwt_slots_t *slots);
+
+typedef struct {
+    VALUE io;
     struct tnt_stream *tnt;
-    st_table *requests;
+    lwt_slots_t requests;
+    lwt_pool_t *pool;
+    uint64_t replies;
+    double latency_avg;   // moving average of reply latency
+    lwt_histogram_t latency;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t send_calls;
+    uint64_t recv_calls;
+    uint64_t recv_data_calls; // recv calls which got data, unlike ones failed with EAGAIN
+    size_t in_flight_max;
+    double cork_window;   // seconds requests may wait in send buffer, 0 if corking is off
+    size_t cork_bytes;    // send buffer size flushed without waiting for cork window
+    int corked;           // send buffer has corked requests and flusher is signalled
+    uint64_t auth_sync;   // sync of auth request sent on connect
+    int auth_pending;     // auth reply isn't received yet
+    uint64_t failovers;   // count of standby connections taken over
+    uint64_t schema_id;   // version of cached schema, 0 if it isn't loaded
+    uint64_t schema_seen; // the latest schema version seen in replies
+    int nonblock;
+    int multiplex;
+    int native_encoder;
 } lwt_conn_t;
 
 typedef struct {
     VALUE conn;
     uint64_t id;
-    struct tnt_reply *reply;
+    struct tnt_reply *reply;      // NULL until request is processed
+    struct tnt_reply reply_data;
+    lwt_pool_t *pool;             // owner of reply_data.buf
+    int released;
+    int shared;                   // reply is shared by coalesced calls, so it's never released
+    double sent_at;
+    double latency;               // seconds from send to reply, 0 until reply
 } lwt_request_t;
 
 VALUE lwt_request_create( VALUE conn, uint64_t id);
-void lwt_request_add_reply( VALUE self, struct tnt_reply *reply);
+void lwt_request_add_reply( VALUE self, const struct tnt_reply *reply, lwt_pool_t *pool);
+double lwt_request_sent_at( VALUE self);
+void lwt_request_set_latency( VALUE self, double latency);
+uint64_t lwt_request_sync( VALUE self);
+const struct tnt_reply *lwt_request_reply( VALUE self);
+
+size_t lwt_pack_sizeof(VALUE obj);
+char *lwt_pack_encode(char *data, VALUE obj);
+
+// lwt_unpack() flags
+#define LWT_UNPACK_SYMBOLIZE_KEYS 1
+#define LWT_UNPACK_FREEZE 2
+
+VALUE lwt_unpack(const char **data, int flags);
+
+VALUE lwt_reply_detach(const struct tnt_reply *reply, int copy);
+VALUE lwt_reply_error(const struct tnt_reply *reply);
+VALUE lwt_reply_result(const struct tnt_reply *reply, VALUE first, VALUE range, int flags);
+VALUE lwt_reply_size(const struct tnt_reply *reply);
+
+// NOP row type, the other types are request codes
+#define LWT_XROW_NOP 12
+
+typedef struct {
+    uint64_t type;
+    uint64_t lsn;
+    uint64_t replica_id;
+    double timestamp;
+    uint64_t space;
+    uint64_t index;
+    int has_space;
+    int has_index;
+    const char *key;      // body fields, NULL if absent
+    const char *tuple;
+    const char *ops;
+    const char *vclock;
+    const char *error;
+} lwt_xrow_t;
+
+const char *lwt_xrow_decode_header(lwt_xrow_t *row, const char *pos);
+void lwt_xrow_decode_body(lwt_xrow_t *row, const char *pos);
+void lwt_xrow_check_filter(VALUE filter);
+int lwt_xrow_match(const lwt_xrow_t *row, VALUE filter);
+VALUE lwt_xrow_to_hash(const lwt_xrow_t *row, int flags);
 
 void init_conn();
 void init_request();
+void init_reply();
+void init_unpack();
+void init_xlog();
+void init_metrics();
 void init_errors();
@@ -0,0 +1,262 @@
+#include <ruby.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "lwtarantool.h"
+
+/*
+ * Latency histograms.
+ *
+ * Values are recorded in microseconds into log-linear buckets like
+ * HdrHistogram does: every power of two range is split into
+ * LWT_HIST_SUB buckets, so a bucket is at most 1/16 of its values wide
+ * and recording is a couple of shifts and an increment. Histograms are
+ * only changed with GVL held, so they don't need locks.
+ */
+
+#define LWT_HIST_SUB (1 << LWT_HIST_SUB_BITS)
+
+static VALUE lwt_cHistogram;
+
+static int
+lwt_histogram_index(uint64_t us) {
+  if (us < LWT_HIST_SUB)
+    return (int)us;
+
+  int exp = 63 - __builtin_clzll(us);
+  if (exp > LWT_HIST_MAX_EXP)
+    return LWT_HIST_BUCKETS - 1;
+
+  uint64_t mantissa = us >> (exp - LWT_HIST_SUB_BITS);
+  return (exp - LWT_HIST_SUB_BITS + 1) * LWT_HIST_SUB + (int)(mantissa - LWT_HIST_SUB);
+}
+
+/*
+ * The highest value of a bucket in microseconds.
+ */
+static uint64_t
+lwt_histogram_bucket_max(int index) {
+  if (index < LWT_HIST_SUB)
+    return index;
+
+  int exp = index / LWT_HIST_SUB + LWT_HIST_SUB_BITS - 1;
+  uint64_t mantissa = index % LWT_HIST_SUB + LWT_HIST_SUB;
+
+  return ((mantissa + 1) << (exp - LWT_HIST_SUB_BITS)) - 1;
+}
+
+void
+lwt_histogram_record(lwt_histogram_t *hist, double seconds) {
+  uint64_t us = seconds > 0 ? (uint64_t)(seconds * 1e6) : 0;
+
+  hist->counts[lwt_histogram_index(us)]++;
+  hist->count++;
+  hist->sum += seconds;
+  if (us > hist->max)
+    hist->max = us;
+}
+
+/*
+ * Value at percentile (0..100) in seconds, 0 for empty histogram.
+ */
+double
+lwt_histogram_percentile(const lwt_histogram_t *hist, double percentile) {
+  if (hist->count == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)ceil(hist->count * percentile / 100.0);
+  uint64_t seen = 0;
+  int i;
+
+  if (rank == 0)
+    rank = 1;
+
+  for (i = 0; i < LWT_HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+    if (seen >= rank) {
+      uint64_t us = lwt_histogram_bucket_max(i);
+      return (us < hist->max ? us : hist->max) / 1e6;
+    }
+  }
+
+  return hist->max / 1e6;
+}
+
+/*
+ * Add latency percentiles of a histogram to stats Hash with given key prefix.
+ */
+void
+lwt_histogram_stats(const lwt_histogram_t *hist, const char *prefix, VALUE hash) {
+  static const struct {
+    const char *name;
+    double percentile;
+  } points[] = {{"p50", 50}, {"p90", 90}, {"p99", 99}, {"p999", 99.9}};
+  char key[64];
+  size_t i;
+
+  for (i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+    snprintf(key, sizeof(key), "%s_%s", prefix, points[i].name);
+    rb_hash_aset(hash, ID2SYM(rb_intern(key)), DBL2NUM(lwt_histogram_percentile(hist, points[i].percentile)));
+  }
+
+  snprintf(key, sizeof(key), "%s_max", prefix);
+  rb_hash_aset(hash, ID2SYM(rb_intern(key)), DBL2NUM(hist->max / 1e6));
+}
+
+static size_t
+lwt_histogram_memsize(const void *hist) {
+  return sizeof(lwt_histogram_t);
+}
+
+static const rb_data_type_t lwt_histogram_type = {
+  "LWTarantool::Histogram",
+  { NULL, RUBY_TYPED_DEFAULT_FREE, lwt_histogram_memsize, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+lwt_histogram_alloc(VALUE klass) {
+  lwt_histogram_t *hist = ZALLOC(lwt_histogram_t);
+
+  return TypedData_Wrap_Struct(klass, &lwt_histogram_type, hist);
+}
+
+static lwt_histogram_t *
+lwt_histogram_get(VALUE self) {
+  lwt_histogram_t *hist;
+  TypedData_Get_Struct(self, lwt_histogram_t, &lwt_histogram_type, hist);
+
+  return hist;
+}
+
+/*
+ * Histogram object with a copy of given histogram.
+ */
+VALUE
+lwt_histogram_dup(const lwt_histogram_t *hist) {
+  VALUE self = lwt_histogram_alloc(lwt_cHistogram);
+
+  memcpy(lwt_histogram_get(self), hist, sizeof(lwt_histogram_t));
+
+  return self;
+}
+
+/*
+ * Copy recorded values on dup and clone.
+ */
+static VALUE
+lwt_histogram_init_copy(VALUE self, VALUE orig) {
+  if (self == orig)
+    return self;
+
+  memcpy(lwt_histogram_get(self), lwt_histogram_get(orig), sizeof(lwt_histogram_t));
+
+  return self;
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * Record a value.
+ *
+ * @param [Numeric] seconds the value.
+ *
+ * @return [LWTarantool::Histogram] self.
+ */
+static VALUE
+lwt_histogram_record_m(VALUE self, VALUE seconds) {
+  lwt_histogram_record(lwt_histogram_get(self), NUM2DBL(seconds));
+
+  return self;
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * Count of recorded values.
+ *
+ * @return [Integer]
+ */
+static VALUE
+lwt_histogram_count(VALUE self) {
+  return ULL2NUM(lwt_histogram_get(self)->count);
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * Sum of recorded values.
+ *
+ * @return [Float] seconds.
+ */
+static VALUE
+lwt_histogram_sum(VALUE self) {
+  return DBL2NUM(lwt_histogram_get(self)->sum);
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * The highest recorded value.
+ *
+ * @return [Float] seconds.
+ */
+static VALUE
+lwt_histogram_max(VALUE self) {
+  return DBL2NUM(lwt_histogram_get(self)->max / 1e6);
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * Value at percentile, with precision of 1/16 of the value.
+ *
+ * @param [Numeric] percentile from 0 to 100.
+ *
+ * @example
+ *   conn.latency.percentile(99.9)
+ *
+ * @return [Float] seconds, 0 if nothing was recorded.
+ */
+static VALUE
+lwt_histogram_percentile_m(VALUE self, VALUE percentile) {
+  double p = NUM2DBL(percentile);
+
+  if (p < 0 || p > 100)
+    rb_raise(rb_eArgError, "percentile must be between 0 and 100");
+
+  return DBL2NUM(lwt_histogram_percentile(lwt_histogram_get(self), p));
+}
+
+/*
+ * Document-class: LWTarantool::Histogram
+ *
+ * Forget all recorded values.
+ *
+ * @return [LWTarantool::Histogram] self.
+ */
+static VALUE
+lwt_histogram_reset(VALUE self) {
+  memset(lwt_histogram_get(self), 0, sizeof(lwt_histogram_t));
+
+  return self;
+}
+
+void init_metrics() {
+  /*
+   * Document-class: LWTarantool::Histogram
+   *
+   * Latency histogram.
+   */
+  lwt_cHistogram = rb_define_class_under(lwt_Class, "Histogram", rb_cObject);
+
+  rb_define_alloc_func(lwt_cHistogram, lwt_histogram_alloc);
+  rb_define_method(lwt_cHistogram, "initialize_copy", lwt_histogram_init_copy, 1);
+  rb_define_method(lwt_cHistogram, "record", lwt_histogram_record_m, 1);
+  rb_define_method(lwt_cHistogram, "count", lwt_histogram_count, 0);
+  rb_define_method(lwt_cHistogram, "sum", lwt_histogram_sum, 0);
+  rb_define_method(lwt_cHistogram, "max", lwt_histogram_max, 0);
+  rb_define_method(lwt_cHistogram, "percentile", lwt_histogram_percentile_m, 1);
+  rb_define_method(lwt_cHistogram, "reset", lwt_histogram_reset, 0);
+}
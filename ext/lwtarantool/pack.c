@@ -0,0 +1,123 @@
+#include <ruby.h>
+#include <ruby/encoding.h>
+#include <msgpuck.h>
+#include "lwtarantool.h"
+
+/*
+ * Native msgpack encoder.
+ *
+ * Encoding is done in two passes: lwt_pack_sizeof() validates an object
+ * and calculates its encoded size, so the caller can reserve room in the
+ * send buffer, then lwt_pack_encode() writes it without any checks.
+ * An object must not be changed between passes.
+ */
+
+static int
+lwt_pack_is_binary(VALUE str) {
+  return ENCODING_GET(str) == rb_ascii8bit_encindex();
+}
+
+static int
+lwt_pack_sizeof_pair(VALUE key, VALUE val, VALUE arg) {
+  size_t *size = (size_t *)arg;
+
+  *size += lwt_pack_sizeof(key);
+  *size += lwt_pack_sizeof(val);
+
+  return ST_CONTINUE;
+}
+
+size_t
+lwt_pack_sizeof(VALUE obj) {
+  size_t size;
+  long i;
+
+  switch (TYPE(obj)) {
+    case T_NIL:
+      return mp_sizeof_nil();
+    case T_TRUE:
+    case T_FALSE:
+      return mp_sizeof_bool(obj == Qtrue);
+    case T_FIXNUM:
+      if (FIX2LONG(obj) < 0)
+        return mp_sizeof_int(FIX2LONG(obj));
+      return mp_sizeof_uint(FIX2LONG(obj));
+    case T_BIGNUM:
+      if (RBIGNUM_NEGATIVE_P(obj))
+        return mp_sizeof_int(rb_big2ll(obj));
+      return mp_sizeof_uint(rb_big2ull(obj));
+    case T_FLOAT:
+      return mp_sizeof_double(RFLOAT_VALUE(obj));
+    case T_SYMBOL:
+      return mp_sizeof_str(RSTRING_LEN(rb_sym2str(obj)));
+    case T_STRING:
+      if (lwt_pack_is_binary(obj))
+        return mp_sizeof_bin(RSTRING_LEN(obj));
+      return mp_sizeof_str(RSTRING_LEN(obj));
+    case T_ARRAY:
+      size = mp_sizeof_array(RARRAY_LEN(obj));
+      for (i = 0; i < RARRAY_LEN(obj); i++)
+        size += lwt_pack_sizeof(RARRAY_AREF(obj, i));
+      return size;
+    case T_HASH:
+      size = mp_sizeof_map(RHASH_SIZE(obj));
+      rb_hash_foreach(obj, lwt_pack_sizeof_pair, (VALUE)&size);
+      return size;
+    default:
+      rb_raise(rb_eTypeError, "can't encode %"PRIsVALUE" to msgpack", rb_obj_class(obj));
+  }
+
+  return 0;
+}
+
+static int
+lwt_pack_encode_pair(VALUE key, VALUE val, VALUE arg) {
+  char **data = (char **)arg;
+
+  *data = lwt_pack_encode(*data, key);
+  *data = lwt_pack_encode(*data, val);
+
+  return ST_CONTINUE;
+}
+
+char *
+lwt_pack_encode(char *data, VALUE obj) {
+  long i;
+  VALUE str;
+
+  switch (TYPE(obj)) {
+    case T_NIL:
+      return mp_encode_nil(data);
+    case T_TRUE:
+    case T_FALSE:
+      return mp_encode_bool(data, obj == Qtrue);
+    case T_FIXNUM:
+      if (FIX2LONG(obj) < 0)
+        return mp_encode_int(data, FIX2LONG(obj));
+      return mp_encode_uint(data, FIX2LONG(obj));
+    case T_BIGNUM:
+      if (RBIGNUM_NEGATIVE_P(obj))
+        return mp_encode_int(data, rb_big2ll(obj));
+      return mp_encode_uint(data, rb_big2ull(obj));
+    case T_FLOAT:
+      return mp_encode_double(data, RFLOAT_VALUE(obj));
+    case T_SYMBOL:
+      str = rb_sym2str(obj);
+      return mp_encode_str(data, RSTRING_PTR(str), RSTRING_LEN(str));
+    case T_STRING:
+      if (lwt_pack_is_binary(obj))
+        return mp_encode_bin(data, RSTRING_PTR(obj), RSTRING_LEN(obj));
+      return mp_encode_str(data, RSTRING_PTR(obj), RSTRING_LEN(obj));
+    case T_ARRAY:
+      data = mp_encode_array(data, RARRAY_LEN(obj));
+      for (i = 0; i < RARRAY_LEN(obj); i++)
+        data = lwt_pack_encode(data, RARRAY_AREF(obj, i));
+      return data;
+    case T_HASH:
+      data = mp_encode_map(data, RHASH_SIZE(obj));
+      rb_hash_foreach(obj, lwt_pack_encode_pair, (VALUE)&data);
+      return data;
+  }
+
+  return data;
+}
@@ -0,0 +1,149 @@
+#include <ruby.h>
+#include "lwtarantool.h"
+
+/*
+ * Per-connection pool of reply buffers.
+ *
+ * Buffers are grouped into power of two size classes and freed buffers
+ * are kept in per-class free lists, so steady traffic doesn't call malloc
+ * at all. Buffers larger than the biggest class are allocated directly.
+ *
+ * Requests may outlive their connection (or be freed after it in the same
+ * GC run), so the pool is reference counted: every allocated buffer holds
+ * a reference, and the pool is destroyed when the connection is gone and
+ * the last buffer is returned.
+ */
+
+#define LWT_POOL_MIN_SHIFT 8
+#define LWT_POOL_MAX_FREE 64
+
+typedef struct lwt_pool_block {
+  struct lwt_pool_block *next;
+} lwt_pool_block_t;
+
+struct lwt_pool {
+  size_t refs;
+  int closed;
+  lwt_pool_block_t *free[LWT_POOL_CLASSES];
+  size_t nfree[LWT_POOL_CLASSES];
+  uint64_t hits;
+  uint64_t misses;
+};
+
+/*
+ * Size class of a buffer or -1 if it's too large for the pool.
+ */
+static int
+lwt_pool_class(size_t size) {
+  int cls = 0;
+
+  while (((size_t)1 << (cls + LWT_POOL_MIN_SHIFT)) < size) {
+    if (++cls == LWT_POOL_CLASSES)
+      return -1;
+  }
+
+  return cls;
+}
+
+static void
+lwt_pool_destroy(lwt_pool_t *pool) {
+  int cls;
+
+  for (cls = 0; cls < LWT_POOL_CLASSES; cls++) {
+    while (pool->free[cls] != NULL) {
+      lwt_pool_block_t *block = pool->free[cls];
+      pool->free[cls] = block->next;
+      xfree(block);
+    }
+  }
+
+  xfree(pool);
+}
+
+lwt_pool_t *
+lwt_pool_new(void) {
+  lwt_pool_t *pool = ZALLOC(lwt_pool_t);
+  pool->refs = 1;
+
+  return pool;
+}
+
+/*
+ * Drop connection reference, the pool is destroyed with the last buffer.
+ */
+void
+lwt_pool_close(lwt_pool_t *pool) {
+  pool->closed = 1;
+
+  if (--pool->refs == 0)
+    lwt_pool_destroy(pool);
+}
+
+char *
+lwt_pool_alloc(lwt_pool_t *pool, size_t size) {
+  int cls = lwt_pool_class(size);
+  char *buf;
+
+  if (cls >= 0 && pool->free[cls] != NULL) {
+    lwt_pool_block_t *block = pool->free[cls];
+    pool->free[cls] = block->next;
+    pool->nfree[cls]--;
+    pool->hits++;
+    buf = (char *)block;
+  } else {
+    pool->misses++;
+    buf = xmalloc(cls >= 0 ? (size_t)1 << (cls + LWT_POOL_MIN_SHIFT) : size);
+  }
+
+  pool->refs++;
+  return buf;
+}
+
+void
+lwt_pool_free(lwt_pool_t *pool, char *buf, size_t size) {
+  int cls = lwt_pool_class(size);
+
+  if (cls >= 0 && !pool->closed && pool->nfree[cls] < LWT_POOL_MAX_FREE) {
+    lwt_pool_block_t *block = (lwt_pool_block_t *)buf;
+    block->next = pool->free[cls];
+    pool->free[cls] = block;
+    pool->nfree[cls]++;
+  } else {
+    xfree(buf);
+  }
+
+  if (--pool->refs == 0)
+    lwt_pool_destroy(pool);
+}
+
+/*
+ * Hand buffer over to a new owner, which frees it with xfree().
+ *
+ * Pool buffers are plain xmalloc() blocks, so the buffer can outlive the
+ * pool and be freed by another Ractor without touching pool state.
+ */
+void
+lwt_pool_detach(lwt_pool_t *pool) {
+  if (--pool->refs == 0)
+    lwt_pool_destroy(pool);
+}
+
+/*
+ * Pool statistics for Connection#stats.
+ */
+void
+lwt_pool_stats(lwt_pool_t *pool, VALUE hash) {
+  size_t cached = 0;
+  int cls;
+
+  for (cls = 0; cls < LWT_POOL_CLASSES; cls++)
+    cached += pool->nfree[cls] << (cls + LWT_POOL_MIN_SHIFT);
+
+  uint64_t total = pool->hits + pool->misses;
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("pool_hits")), ULL2NUM(pool->hits));
+  rb_hash_aset(hash, ID2SYM(rb_intern("pool_misses")), ULL2NUM(pool->misses));
+  rb_hash_aset(hash, ID2SYM(rb_intern("pool_hit_rate")), DBL2NUM(total ? (double)pool->hits / total : 0.0));
+  rb_hash_aset(hash, ID2SYM(rb_intern("pool_cached_bytes")), SIZET2NUM(cached));
+  rb_hash_aset(hash, ID2SYM(rb_intern("pool_buffers_in_use")), SIZET2NUM(pool->refs - (pool->closed ? 0 : 1)));
+}
@@ -0,0 +1,240 @@
+#include <ruby.h>
+#include <msgpuck.h>
+#include "lwtarantool.h"
+
+/*
+ * Reply detached from its request.
+ *
+ * Reply owns its buffer and is frozen from birth, so it's shareable
+ * between Ractors: a reply received by one Ractor is decoded by another
+ * without copying the buffer. Decoders are shared with Request.
+ */
+
+static VALUE lwt_cReply;
+
+static void
+lwt_reply_free(void *ptr) {
+  struct tnt_reply *reply = ptr;
+
+  xfree((char *)reply->buf);
+  xfree(reply);
+}
+
+static size_t
+lwt_reply_memsize(const void *ptr) {
+  const struct tnt_reply *reply = ptr;
+
+  return sizeof(*reply) + reply->buf_size;
+}
+
+static const rb_data_type_t lwt_reply_type = {
+  "LWTarantool::Reply",
+  { NULL, lwt_reply_free, lwt_reply_memsize, },
+  0, 0,
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE,
+#else
+  RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static const struct tnt_reply *
+lwt_reply_get(VALUE self) {
+  struct tnt_reply *reply;
+  TypedData_Get_Struct(self, struct tnt_reply, &lwt_reply_type, reply);
+
+  return reply;
+}
+
+/*
+ * Move a pointer into a copy of reply buffer.
+ *
+ * Pointers out of the buffer are kept, e.g. errors of timed out and
+ * canceled requests are static strings of a reply without buffer.
+ */
+static const char *
+lwt_reply_rebase(const char *ptr, const struct tnt_reply *from, const char *to) {
+  if (ptr == NULL || from->buf == NULL || ptr < from->buf || ptr > from->buf + from->buf_size)
+    return ptr;
+
+  return to + (ptr - from->buf);
+}
+
+/*
+ * Wrap reply buffer into a frozen Reply.
+ *
+ * Reply takes ownership of the buffer, it must be detached from its pool
+ * by caller. With copy the buffer is left to caller and reply gets a copy.
+ */
+VALUE
+lwt_reply_detach(const struct tnt_reply *reply, int copy) {
+  struct tnt_reply *res = ALLOC(struct tnt_reply);
+  *res = *reply;
+
+  if (copy) {
+    char *buf = NULL;
+    if (reply->buf != NULL) {
+      buf = xmalloc(reply->buf_size);
+      memcpy(buf, reply->buf, reply->buf_size);
+    }
+
+    res->buf = buf;
+    res->error = lwt_reply_rebase(reply->error, reply, buf);
+    res->error_end = lwt_reply_rebase(reply->error_end, reply, buf);
+    res->data = lwt_reply_rebase(reply->data, reply, buf);
+    res->data_end = lwt_reply_rebase(reply->data_end, reply, buf);
+    res->metadata = lwt_reply_rebase(reply->metadata, reply, buf);
+    res->metadata_end = lwt_reply_rebase(reply->metadata_end, reply, buf);
+    res->sqlinfo = lwt_reply_rebase(reply->sqlinfo, reply, buf);
+    res->sqlinfo_end = lwt_reply_rebase(reply->sqlinfo_end, reply, buf);
+  }
+
+  VALUE self = TypedData_Wrap_Struct(lwt_cReply, &lwt_reply_type, res);
+  return rb_obj_freeze(self);
+}
+
+/*
+ * Error message of failed reply, nil if reply succeeded.
+ */
+VALUE
+lwt_reply_error(const struct tnt_reply *reply) {
+  if (reply->code == 0 || reply->error == NULL)
+    return Qnil;
+
+  return rb_str_new(reply->error, reply->error_end - reply->error);
+}
+
+/*
+ * Decode reply data.
+ *
+ * Only the first tuple or tuples of a range are decoded if requested,
+ * others are skipped without creating Ruby objects.
+ */
+VALUE
+lwt_reply_result(const struct tnt_reply *reply, VALUE first, VALUE range, int flags) {
+  if (reply->code != 0)
+    return Qnil;
+
+  const char *data = reply->data;
+  if (data == NULL)
+    return Qnil;
+
+  if ((!RTEST(first) && NIL_P(range)) || mp_typeof(*data) != MP_ARRAY)
+    return lwt_unpack(&data, flags);
+
+  uint32_t count = mp_decode_array(&data);
+
+  if (RTEST(first))
+    return count > 0 ? lwt_unpack(&data, flags) : Qnil;
+
+  long beg, len, i;
+  VALUE valid = rb_range_beg_len(range, &beg, &len, count, 0);
+  if (valid == Qfalse)
+    rb_raise(rb_eTypeError, "range must be a Range");
+  if (valid == Qnil)
+    return Qnil;
+
+  for (i = 0; i < beg; i++)
+    mp_next(&data);
+
+  VALUE res = rb_ary_new_capa(len);
+  for (i = 0; i < len; i++)
+    rb_ary_push(res, lwt_unpack(&data, flags));
+
+  return res;
+}
+
+/*
+ * Number of tuples in successful reply without decoding them.
+ */
+VALUE
+lwt_reply_size(const struct tnt_reply *reply) {
+  if (reply->code != 0 || reply->data == NULL)
+    return Qnil;
+
+  if (mp_typeof(*reply->data) != MP_ARRAY)
+    return INT2FIX(1);
+
+  const char *data = reply->data;
+  return UINT2NUM(mp_decode_array(&data));
+}
+
+static int
+lwt_reply_flags(VALUE symbolize_keys, VALUE freeze) {
+  int flags = 0;
+
+  if (RTEST(symbolize_keys))
+    flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    flags |= LWT_UNPACK_FREEZE;
+
+  return flags;
+}
+
+static VALUE
+lwt_reply_m_error(VALUE self) {
+  return lwt_reply_error(lwt_reply_get(self));
+}
+
+static VALUE
+lwt_reply_m_result(VALUE self, VALUE first, VALUE range, VALUE symbolize_keys, VALUE freeze) {
+  return lwt_reply_result(lwt_reply_get(self), first, range, lwt_reply_flags(symbolize_keys, freeze));
+}
+
+static VALUE
+lwt_reply_m_size(VALUE self) {
+  return lwt_reply_size(lwt_reply_get(self));
+}
+
+/*
+ * Size of reply buffer in bytes.
+ *
+ * @return [Integer] size.
+ */
+static VALUE
+lwt_reply_bytesize(VALUE self) {
+  return SIZET2NUM(lwt_reply_get(self)->buf_size);
+}
+
+/*
+ * Decode tuples one by one, reply is immutable so the cursor is kept
+ * as a pointer.
+ */
+static VALUE
+lwt_reply_each_tuple(VALUE self, VALUE symbolize_keys, VALUE freeze) {
+  const struct tnt_reply *reply = lwt_reply_get(self);
+  if (reply->code != 0 || reply->data == NULL)
+    return Qnil;
+
+  int flags = lwt_reply_flags(symbolize_keys, freeze);
+  const char *data = reply->data;
+
+  if (mp_typeof(*data) != MP_ARRAY) {
+    rb_yield(lwt_unpack(&data, flags));
+    return self;
+  }
+
+  uint32_t count = mp_decode_array(&data);
+  uint32_t i;
+
+  for (i = 0; i < count; i++)
+    rb_yield(lwt_unpack(&data, flags));
+
+  return self;
+}
+
+void init_reply() {
+  /*
+   * Document-class: LWTarantool::Reply
+   *
+   * Frozen reply detached from request, shareable between Ractors.
+   */
+  lwt_cReply = rb_define_class_under(lwt_Class, "Reply", rb_cObject);
+  rb_undef_alloc_func(lwt_cReply);
+
+  rb_define_method(lwt_cReply, "bytesize", lwt_reply_bytesize, 0);
+  rb_define_private_method(lwt_cReply, "_error", lwt_reply_m_error, 0);
+  rb_define_private_method(lwt_cReply, "_result", lwt_reply_m_result, 4);
+  rb_define_private_method(lwt_cReply, "_size", lwt_reply_m_size, 0);
+  rb_define_private_method(lwt_cReply, "_each_tuple", lwt_reply_each_tuple, 2);
+}
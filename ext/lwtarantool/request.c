@@ -1,19 +1,40 @@
 #include <ruby.h>
+#include <msgpuck.h>
 #include "lwtarantool.h"
 
 static VALUE rClass;
 
 static void
-lwt_request_dealloc(lwt_request_t *req) {
-  if (req == NULL)
-    return;
+lwt_request_free_reply(lwt_request_t *req) {
+  if (req->pool != NULL && req->reply_data.buf != NULL)
+    lwt_pool_free(req->pool, (char *)req->reply_data.buf, req->reply_data.buf_size);
 
-  if (req->reply == NULL)
-    return;
+  req->reply_data.buf = NULL;
+  req->pool = NULL;
+}
+
+static void
+lwt_request_dealloc(void *ptr) {
+  lwt_request_t *req = ptr;
 
-  tnt_reply_free(req->reply);
+  lwt_request_free_reply(req);
+  xfree(req);
 }
 
+static size_t
+lwt_request_memsize(const void *ptr) {
+  const lwt_request_t *req = ptr;
+
+  return sizeof(*req) + (req->pool != NULL ? req->reply_data.buf_size : 0);
+}
+
+static const rb_data_type_t lwt_request_type = {
+  "LWTarantool::Request",
+  { NULL, lwt_request_dealloc, lwt_request_memsize, },
+  0, 0,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
 
 VALUE
 lwt_request_create( VALUE conn, uint64_t id) {
@@ -22,8 +43,9 @@ lwt_request_create( VALUE conn, uint64_t id) {
 
   req = ZALLOC(lwt_request_t);
   req->id = id;
+  req->sent_at = lwt_clock();
 
-  self = Data_Wrap_Struct( rClass, NULL, lwt_request_dealloc, req);
+  self = TypedData_Wrap_Struct( rClass, &lwt_request_type, req);
   rb_iv_set(self, "@conn", conn);
 
   //printf("Create request %p, reply: %p\n", req, req->reply);
@@ -31,14 +53,150 @@ lwt_request_create( VALUE conn, uint64_t id) {
   return self;
 }
 
+/*
+ * Store processed reply in request.
+ *
+ * Request takes ownership of reply buffer allocated from pool.
+ */
 void
-lwt_request_add_reply( VALUE self, struct tnt_reply *reply) {
+lwt_request_add_reply( VALUE self, const struct tnt_reply *reply, lwt_pool_t *pool) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
   //printf("Add reply %p to request %p\n", reply, req);
 
-  req->reply = reply;
+  req->reply_data = *reply;
+  req->pool = pool;
+  req->reply = &req->reply_data;
+}
+
+double
+lwt_request_sent_at( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  return req->sent_at;
+}
+
+void
+lwt_request_set_latency( VALUE self, double latency) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  req->latency = latency;
+}
+
+uint64_t
+lwt_request_sync( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  return req->id;
+}
+
+/*
+ * Received reply or NULL if request isn't processed or reply was released.
+ */
+const struct tnt_reply *
+lwt_request_reply( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  return req->released ? NULL : req->reply;
+}
+
+static void
+lwt_request_check_released(lwt_request_t *req) {
+  if (req->released)
+    rb_raise(lwt_eError, "reply was released");
+}
+
+/*
+ * Document-class: LWTarantool::Request
+ *
+ * Return reply buffer to connection pool.
+ *
+ * Request result and error can't be got after it.
+ * Does nothing if request isn't processed yet or it is shared by
+ * coalesced calls of an idempotent function.
+ */
+static VALUE
+lwt_request_release( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  if (req->reply == NULL || req->shared)
+    return Qnil;
+
+  lwt_request_free_reply(req);
+  req->released = 1;
+
+  return Qnil;
+}
+
+/*
+ * Document-class: LWTarantool::Request
+ *
+ * Time from sending request to receiving its reply.
+ *
+ * @return [Float, nil] seconds, nil if reply isn't received yet.
+ */
+static VALUE
+lwt_request_latency( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  return req->latency > 0 ? DBL2NUM(req->latency) : Qnil;
+}
+
+/*
+ * Mark request as shared, so callers can't release its reply.
+ */
+static VALUE
+lwt_request_share( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  req->shared = 1;
+
+  return self;
+}
+
+/*
+ * Move reply buffer into a frozen Reply without copying and release
+ * the request. Reply shared by coalesced calls is copied instead, other
+ * callers still read it.
+ */
+static VALUE
+lwt_request_detach( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  if (req->reply == NULL)
+    return Qnil;
+
+  lwt_request_check_released(req);
+
+  if (req->shared || req->pool == NULL)
+    return lwt_reply_detach(req->reply, 1);
+
+  VALUE reply = lwt_reply_detach(req->reply, 0);
+  lwt_pool_detach(req->pool);
+  req->reply_data.buf = NULL;
+  req->pool = NULL;
+  req->released = 1;
+
+  return reply;
+}
+
+/*
+ * Size of reply buffer, 0 if request isn't processed yet.
+ */
+static VALUE
+lwt_request_bytesize( VALUE self) {
+  const struct tnt_reply *reply = lwt_request_reply(self);
+
+  return SIZET2NUM(reply ? reply->buf_size : 0);
 }
 
 /*
@@ -51,7 +209,7 @@ lwt_request_add_reply( VALUE self, struct tnt_reply *reply) {
 static VALUE
 lwt_request_id( VALUE self) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
   return rb_uint2inum(req->id);
 }
@@ -64,7 +222,7 @@ lwt_request_id( VALUE self) {
 static VALUE
 lwt_request_is_ready( VALUE self) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
   if (req->reply == NULL) 
     return Qfalse;
@@ -76,7 +234,7 @@ lwt_request_is_ready( VALUE self) {
 static VALUE
 lwt_request_code( VALUE self) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
   if (req->reply == NULL) 
     return Qnil;
@@ -88,36 +246,216 @@ lwt_request_code( VALUE self) {
 static VALUE
 lwt_request_error( VALUE self) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
   if (req->reply == NULL)
     return Qnil;
 
-  if (req->reply->code == 0)
+  lwt_request_check_released(req);
+
+  return lwt_reply_error(req->reply);
+}
+
+static VALUE
+lwt_request_result( VALUE self, VALUE first, VALUE range, VALUE symbolize_keys, VALUE freeze) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  if (req->reply == NULL)
     return Qnil;
 
-  if (req->reply->error == NULL)
+  lwt_request_check_released(req);
+
+  int flags = 0;
+  if (RTEST(symbolize_keys))
+    flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    flags |= LWT_UNPACK_FREEZE;
+
+  return lwt_reply_result(req->reply, first, range, flags);
+}
+
+/*
+ * Successful reply or NULL if request isn't processed or failed.
+ */
+static const struct tnt_reply *
+lwt_request_ok_reply(lwt_request_t *req) {
+  if (req->reply == NULL)
+    return NULL;
+
+  lwt_request_check_released(req);
+
+  return req->reply->code == 0 ? req->reply : NULL;
+}
+
+/*
+ * Number of tuples in reply without decoding them.
+ */
+static VALUE
+lwt_request_size( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL)
     return Qnil;
 
-  const char *data = req->reply->error;
-  size_t data_len = req->reply->error_end - data;
-  return rb_str_new(data, data_len);
+  return lwt_reply_size(reply);
 }
 
+/*
+ * Decode tuples one by one, yielding each of them.
+ *
+ * Cursor is kept as offset and reply is checked before every tuple,
+ * because the block may release it.
+ */
 static VALUE
-lwt_request_result( VALUE self) {
+lwt_request_each_tuple( VALUE self, VALUE symbolize_keys, VALUE freeze) {
   lwt_request_t * req;
-  Data_Get_Struct(self, lwt_request_t, req);
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
 
-  if (req->reply == NULL)
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->data == NULL)
     return Qnil;
 
-  if (req->reply->code != 0)
+  int flags = 0;
+  if (RTEST(symbolize_keys))
+    flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    flags |= LWT_UNPACK_FREEZE;
+
+  const char *data = reply->data;
+
+  if (mp_typeof(*data) != MP_ARRAY) {
+    rb_yield(lwt_unpack(&data, flags));
+    return self;
+  }
+
+  uint32_t count = mp_decode_array(&data);
+  size_t offset = data - reply->data;
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    lwt_request_check_released(req);
+
+    data = req->reply->data + offset;
+    VALUE tuple = lwt_unpack(&data, flags);
+    offset = data - req->reply->data;
+
+    rb_yield(tuple);
+  }
+
+  return self;
+}
+
+/*
+ * Check if SQL metadata of reply is the same as given raw metadata.
+ */
+static VALUE
+lwt_request_metadata_match( VALUE self, VALUE raw) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  Check_Type(raw, T_STRING);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->metadata == NULL)
+    return Qfalse;
+
+  size_t len = reply->metadata_end - reply->metadata;
+  if ((size_t)RSTRING_LEN(raw) != len || memcmp(RSTRING_PTR(raw), reply->metadata, len) != 0)
+    return Qfalse;
+
+  return Qtrue;
+}
+
+static VALUE
+lwt_request_metadata_raw( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->metadata == NULL)
     return Qnil;
 
-  const char *data = req->reply->data;
-  size_t data_len = req->reply->data_end - data;
-  return rb_str_new(data, data_len);
+  return rb_str_new(reply->metadata, reply->metadata_end - reply->metadata);
+}
+
+static VALUE
+lwt_request_metadata( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->metadata == NULL)
+    return Qnil;
+
+  const char *data = reply->metadata;
+  return lwt_unpack(&data, LWT_UNPACK_FREEZE);
+}
+
+static VALUE
+lwt_request_sql_info( VALUE self) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->sqlinfo == NULL)
+    return Qnil;
+
+  const char *data = reply->sqlinfo;
+  return lwt_unpack(&data, 0);
+}
+
+/*
+ * Decode rows of SQL result into per-column arrays.
+ *
+ * Missing values of short rows are nil, extra values are skipped.
+ */
+static VALUE
+lwt_request_columns( VALUE self, VALUE count, VALUE symbolize_keys, VALUE freeze) {
+  lwt_request_t * req;
+  TypedData_Get_Struct(self, lwt_request_t, &lwt_request_type, req);
+
+  const struct tnt_reply *reply = lwt_request_ok_reply(req);
+  if (reply == NULL || reply->data == NULL || mp_typeof(*reply->data) != MP_ARRAY)
+    return Qnil;
+
+  int flags = 0;
+  if (RTEST(symbolize_keys))
+    flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    flags |= LWT_UNPACK_FREEZE;
+
+  const char *data = reply->data;
+  uint32_t rows = mp_decode_array(&data);
+  long ncols = NUM2LONG(count);
+  long i, j;
+
+  VALUE res = rb_ary_new_capa(ncols);
+  for (j = 0; j < ncols; j++)
+    rb_ary_push(res, rb_ary_new_capa(rows));
+
+  for (i = 0; i < rows; i++) {
+    long len = 0;
+
+    if (mp_typeof(*data) == MP_ARRAY)
+      len = mp_decode_array(&data);
+    else
+      mp_next(&data);
+
+    for (j = 0; j < len; j++) {
+      if (j < ncols)
+        rb_ary_push(RARRAY_AREF(res, j), lwt_unpack(&data, flags));
+      else
+        mp_next(&data);
+    }
+
+    for (j = len; j < ncols; j++)
+      rb_ary_push(RARRAY_AREF(res, j), Qnil);
+  }
+
+  return res;
 }
 
 void init_request() {
@@ -127,10 +465,23 @@ void init_request() {
    * Class for work with Tarantool requests
    */
   rClass = rb_define_class_under( lwt_Class, "Request", rb_cObject);
+  rb_undef_alloc_func(rClass);
 
   rb_define_method(rClass, "id", lwt_request_id, 0);
+  rb_define_method(rClass, "latency", lwt_request_latency, 0);
   rb_define_method(rClass, "ready?", lwt_request_is_ready, 0);
+  rb_define_method(rClass, "release", lwt_request_release, 0);
   //rb_define_method(rClass, "code", lwt_request_code, 0);
   rb_define_private_method(rClass, "_error", lwt_request_error, 0);
-  rb_define_private_method(rClass, "_result", lwt_request_result, 0);
+  rb_define_private_method(rClass, "_result", lwt_request_result, 4);
+  rb_define_private_method(rClass, "_size", lwt_request_size, 0);
+  rb_define_private_method(rClass, "_share", lwt_request_share, 0);
+  rb_define_private_method(rClass, "_bytesize", lwt_request_bytesize, 0);
+  rb_define_private_method(rClass, "_detach", lwt_request_detach, 0);
+  rb_define_private_method(rClass, "_each_tuple", lwt_request_each_tuple, 2);
+  rb_define_private_method(rClass, "_metadata_match?", lwt_request_metadata_match, 1);
+  rb_define_private_method(rClass, "_metadata_raw", lwt_request_metadata_raw, 0);
+  rb_define_private_method(rClass, "_metadata", lwt_request_metadata, 0);
+  rb_define_private_method(rClass, "_sql_info", lwt_request_sql_info, 0);
+  rb_define_private_method(rClass, "_columns", lwt_request_columns, 3);
 }
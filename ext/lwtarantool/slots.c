@@ -0,0 +1,191 @@
+#include <ruby.h>
+#include "lwtarantool.h"
+
+/*
+ * Table of pending requests.
+ *
+ * Sync ids are allocated sequentially from tnt_stream.reqid, so pending
+ * requests always lie in a window [head, tail) of ids and a request is
+ * stored in slot (sync & mask) of a power of two ring. Lookups don't hash
+ * and the table grows only when the window gets wider than the ring.
+ *
+ * Requests are marked with rb_gc_mark_movable() over the window and
+ * updated by lwt_slots_compact(), so they can be moved by GC.compact.
+ *
+ * A timed out request leaves LWT_SLOT_ABANDONED in its slot, so its late
+ * reply is recognized and dropped.
+ */
+
+#define LWT_SLOTS_MIN_SIZE 64
+
+void
+lwt_slots_init(lwt_slots_t *slots) {
+  slots->size = LWT_SLOTS_MIN_SIZE;
+  slots->ring = ZALLOC_N(lwt_slot_t, slots->size);
+  slots->head = 0;
+  slots->tail = 0;
+  slots->count = 0;
+  slots->abandoned = 0;
+}
+
+void
+lwt_slots_free(lwt_slots_t *slots) {
+  xfree(slots->ring);
+  slots->ring = NULL;
+}
+
+static void
+lwt_slots_grow(lwt_slots_t *slots, size_t size) {
+  lwt_slot_t *ring = ZALLOC_N(lwt_slot_t, size);
+  uint64_t sync;
+
+  for (sync = slots->head; sync != slots->tail; sync++) {
+    lwt_slot_t *slot = &slots->ring[sync & (slots->size - 1)];
+    if (slot->req != 0)
+      ring[sync & (size - 1)] = *slot;
+  }
+
+  xfree(slots->ring);
+  slots->ring = ring;
+  slots->size = size;
+}
+
+void
+lwt_slots_insert(lwt_slots_t *slots, uint64_t sync, VALUE req) {
+  if (slots->count == 0) {
+    slots->head = sync;
+    slots->tail = sync;
+  }
+
+  if (sync < slots->head)
+    rb_raise(lwt_eUnknownError, "Sync id %llu is out of order", (unsigned long long)sync);
+
+  size_t size = slots->size;
+  while (sync - slots->head >= size)
+    size <<= 1;
+
+  if (size != slots->size)
+    lwt_slots_grow(slots, size);
+
+  lwt_slot_t *slot = &slots->ring[sync & (slots->size - 1)];
+  slot->sync = sync;
+  slot->req = req;
+  slots->count++;
+
+  if (sync >= slots->tail)
+    slots->tail = sync + 1;
+}
+
+static lwt_slot_t *
+lwt_slots_find(lwt_slots_t *slots, uint64_t sync) {
+  if (slots->count == 0 || sync < slots->head || sync >= slots->tail)
+    return NULL;
+
+  lwt_slot_t *slot = &slots->ring[sync & (slots->size - 1)];
+
+  if (slot->req == 0 || slot->sync != sync)
+    return NULL;
+
+  return slot;
+}
+
+/*
+ * Remove a request from table.
+ *
+ * Returns Qundef if there is no request with such sync id
+ * and LWT_SLOT_ABANDONED if the request was abandoned.
+ */
+VALUE
+lwt_slots_delete(lwt_slots_t *slots, uint64_t sync) {
+  lwt_slot_t *slot = lwt_slots_find(slots, sync);
+  if (slot == NULL)
+    return Qundef;
+
+  size_t mask = slots->size - 1;
+  VALUE req = slot->req;
+  slot->req = 0;
+  slots->count--;
+  if (req == LWT_SLOT_ABANDONED)
+    slots->abandoned--;
+
+  if (slots->count == 0) {
+    slots->head = slots->tail;
+  } else {
+    while (slots->ring[slots->head & mask].req == 0)
+      slots->head++;
+  }
+
+  return req;
+}
+
+/*
+ * Replace a request with LWT_SLOT_ABANDONED mark.
+ *
+ * The slot is kept until reply is received or connection is closed.
+ * Returns Qundef if there is no such pending request.
+ */
+VALUE
+lwt_slots_abandon(lwt_slots_t *slots, uint64_t sync) {
+  lwt_slot_t *slot = lwt_slots_find(slots, sync);
+  if (slot == NULL || slot->req == LWT_SLOT_ABANDONED)
+    return Qundef;
+
+  VALUE req = slot->req;
+  slot->req = LWT_SLOT_ABANDONED;
+  slots->abandoned++;
+
+  return req;
+}
+
+/*
+ * Remove all requests calling func for each one.
+ */
+void
+lwt_slots_clear(lwt_slots_t *slots, void (*func)(VALUE req)) {
+  size_t mask = slots->size - 1;
+  uint64_t sync;
+
+  for (sync = slots->head; sync != slots->tail; sync++) {
+    lwt_slot_t *slot = &slots->ring[sync & mask];
+    if (slot->req == 0)
+      continue;
+
+    VALUE req = slot->req;
+    slot->req = 0;
+    slots->count--;
+    if (req != LWT_SLOT_ABANDONED)
+      func(req);
+  }
+
+  slots->head = slots->tail;
+  slots->abandoned = 0;
+}
+
+void
+lwt_slots_mark(lwt_slots_t *slots) {
+  size_t mask = slots->size - 1;
+  uint64_t sync;
+
+  for (sync = slots->head; sync != slots->tail; sync++) {
+    VALUE req = slots->ring[sync & mask].req;
+    if (req != 0 && req != LWT_SLOT_ABANDONED)
+      rb_gc_mark_movable(req);
+  }
+}
+
+void
+lwt_slots_compact(lwt_slots_t *slots) {
+  size_t mask = slots->size - 1;
+  uint64_t sync;
+
+  for (sync = slots->head; sync != slots->tail; sync++) {
+    lwt_slot_t *slot = &slots->ring[sync & mask];
+    if (slot->req != 0 && slot->req != LWT_SLOT_ABANDONED)
+      slot->req = rb_gc_location(slot->req);
+  }
+}
+
+size_t
+lwt_slots_memsize(const lwt_slots_t *slots) {
+  return slots->size * sizeof(lwt_slot_t);
+}
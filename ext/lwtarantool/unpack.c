@@ -0,0 +1,123 @@
+#include <ruby.h>
+#include <ruby/encoding.h>
+#include <msgpuck.h>
+#include "lwtarantool.h"
+
+/*
+ * Native msgpack decoder.
+ *
+ * Data must be already checked by mp_check(), tnt_reply() does it for
+ * every reply, so decoder doesn't validate it again.
+ */
+
+static VALUE lwt_cExtensionValue;
+
+static VALUE
+lwt_unpack_str(const char *str, uint32_t len, int flags) {
+  if (!(flags & LWT_UNPACK_FREEZE))
+    return rb_utf8_str_new(str, len);
+
+#ifdef HAVE_RB_ENC_INTERNED_STR
+  return rb_enc_interned_str(str, len, rb_utf8_encoding());
+#else
+  return rb_str_freeze(rb_utf8_str_new(str, len));
+#endif
+}
+
+/*
+ * Vendored msgpuck has no mp_decode_ext(), so decode ext header here.
+ */
+static const char *
+lwt_unpack_ext(const char **data, int8_t *type, uint32_t *len) {
+  uint8_t c = mp_load_u8(data);
+
+  switch (c) {
+    case 0xd4: *len = 1; break;
+    case 0xd5: *len = 2; break;
+    case 0xd6: *len = 4; break;
+    case 0xd7: *len = 8; break;
+    case 0xd8: *len = 16; break;
+    case 0xc7: *len = mp_load_u8(data); break;
+    case 0xc8: *len = mp_load_u16(data); break;
+    default: *len = mp_load_u32(data); break;
+  }
+
+  *type = (int8_t)mp_load_u8(data);
+
+  const char *str = *data;
+  *data += *len;
+  return str;
+}
+
+static VALUE
+lwt_unpack_key(const char **data, int flags) {
+  if ((flags & LWT_UNPACK_SYMBOLIZE_KEYS) && mp_typeof(**data) == MP_STR) {
+    uint32_t len;
+    const char *str = mp_decode_str(data, &len);
+    // keys come from server data, so symbols must be dynamic (collectable), not interned IDs
+    return rb_str_intern(lwt_unpack_str(str, len, LWT_UNPACK_FREEZE));
+  }
+
+  return lwt_unpack(data, flags);
+}
+
+VALUE
+lwt_unpack(const char **data, int flags) {
+  uint32_t len, i;
+  const char *str;
+  VALUE res;
+
+  switch (mp_typeof(**data)) {
+    case MP_NIL:
+      mp_decode_nil(data);
+      return Qnil;
+    case MP_BOOL:
+      return mp_decode_bool(data) ? Qtrue : Qfalse;
+    case MP_UINT:
+      return ULL2NUM(mp_decode_uint(data));
+    case MP_INT:
+      return LL2NUM(mp_decode_int(data));
+    case MP_FLOAT:
+      return DBL2NUM(mp_decode_float(data));
+    case MP_DOUBLE:
+      return DBL2NUM(mp_decode_double(data));
+    case MP_STR:
+      str = mp_decode_str(data, &len);
+      return lwt_unpack_str(str, len, flags);
+    case MP_BIN:
+      str = mp_decode_bin(data, &len);
+      res = rb_str_new(str, len);
+      return (flags & LWT_UNPACK_FREEZE) ? rb_str_freeze(res) : res;
+    case MP_ARRAY:
+      len = mp_decode_array(data);
+      res = rb_ary_new_capa(len);
+      for (i = 0; i < len; i++)
+        rb_ary_push(res, lwt_unpack(data, flags));
+      return res;
+    case MP_MAP:
+      len = mp_decode_map(data);
+      res = rb_hash_new();
+      for (i = 0; i < len; i++) {
+        VALUE key = lwt_unpack_key(data, flags);
+        rb_hash_aset(res, key, lwt_unpack(data, flags));
+      }
+      return res;
+    case MP_EXT: {
+      int8_t type;
+      str = lwt_unpack_ext(data, &type, &len);
+      return rb_struct_new(lwt_cExtensionValue, INT2FIX(type), rb_str_new(str, len));
+    }
+  }
+
+  rb_raise(lwt_eUnknownError, "unknown msgpack type");
+  return Qnil;
+}
+
+void init_unpack() {
+  /*
+   * Document-class: LWTarantool::ExtensionValue
+   *
+   * Msgpack extension (decimal, uuid, datetime and so on) with raw payload.
+   */
+  lwt_cExtensionValue = rb_struct_define_under(lwt_Class, "ExtensionValue", "type", "payload", NULL);
+}
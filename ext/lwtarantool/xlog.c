@@ -0,0 +1,560 @@
+#include <ruby.h>
+#include <ruby/thread.h>
+#include <msgpuck.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <tarantool/tnt_proto.h>
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+#include "lwtarantool.h"
+
+/*
+ * Reader of Tarantool snapshot and xlog files (format 0.13).
+ *
+ * File is mapped into memory. It starts with a text meta block ended by an
+ * empty line, then goes a sequence of transactions. Every transaction has
+ * a 19 bytes fixed header: a marker, then msgpack encoded length of rows,
+ * crc32c of the previous and the current transaction and a str padding.
+ * Rows of a transaction are msgpack header and body maps, rows of a marked
+ * as compressed transaction are zstd compressed.
+ *
+ * Transactions are scanned (and decompressed) by lwt_xlog_prepare() without
+ * GVL, so several files can be prepared in parallel, and rows are decoded
+ * with GVL one by one while iterating.
+ *
+ * Checksums aren't verified.
+ */
+
+#define LWT_XLOG_FIXHEADER_SIZE 19
+
+static const char lwt_xlog_row_marker[] = "\xd5\xba\x0b\xab";
+static const char lwt_xlog_zrow_marker[] = "\xd5\xba\x0b\xba";
+static const char lwt_xlog_eof_marker[] = "\xd5\x10\xad\xed";
+
+static VALUE lwt_cXlog;
+static VALUE lwt_eXlogError;
+
+typedef struct {
+  const char *data;
+  size_t size;
+  int owned;          // decompressed data, must be freed
+} lwt_xlog_tx_t;
+
+typedef struct {
+  char *map;
+  size_t map_size;
+  const char *rows;   // the first transaction
+  lwt_xlog_tx_t *txs;
+  size_t ntxs;
+  size_t txs_capa;
+  int prepared;
+  int busy;           // prepared or iterated now, can't be closed
+  int eof;            // file has EOF marker
+  const char *error;  // error of preparing
+} lwt_xlog_t;
+
+static void
+lwt_xlog_free_txs(lwt_xlog_t *xlog) {
+  size_t i;
+
+  for (i = 0; i < xlog->ntxs; i++) {
+    if (xlog->txs[i].owned)
+      free((void *)xlog->txs[i].data);
+  }
+
+  free(xlog->txs);
+  xlog->txs = NULL;
+  xlog->ntxs = 0;
+  xlog->txs_capa = 0;
+  xlog->prepared = 0;
+}
+
+static void
+lwt_xlog_unmap(lwt_xlog_t *xlog) {
+  lwt_xlog_free_txs(xlog);
+
+  if (xlog->map != NULL)
+    munmap(xlog->map, xlog->map_size);
+
+  xlog->map = NULL;
+  xlog->map_size = 0;
+  xlog->rows = NULL;
+}
+
+static void
+lwt_xlog_dealloc(void *ptr) {
+  lwt_xlog_t *xlog = ptr;
+
+  lwt_xlog_unmap(xlog);
+  xfree(xlog);
+}
+
+static size_t
+lwt_xlog_memsize(const void *ptr) {
+  const lwt_xlog_t *xlog = ptr;
+
+  return sizeof(lwt_xlog_t) + xlog->txs_capa * sizeof(lwt_xlog_tx_t);
+}
+
+static const rb_data_type_t lwt_xlog_type = {
+  "LWTarantool::Xlog",
+  {NULL, lwt_xlog_dealloc, lwt_xlog_memsize,},
+  0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+lwt_xlog_alloc(VALUE klass) {
+  lwt_xlog_t *xlog;
+
+  return TypedData_Make_Struct(klass, lwt_xlog_t, &lwt_xlog_type, xlog);
+}
+
+static lwt_xlog_t *
+lwt_xlog_get(VALUE self) {
+  lwt_xlog_t *xlog;
+  TypedData_Get_Struct(self, lwt_xlog_t, &lwt_xlog_type, xlog);
+
+  if (xlog->map == NULL)
+    rb_raise(lwt_eXlogError, "file is closed");
+
+  return xlog;
+}
+
+/*
+ * Map a file and parse its meta block.
+ *
+ * Returns meta as a Hash with "type" and "version" keys added.
+ */
+static VALUE
+lwt_xlog_open(VALUE self, VALUE path) {
+  lwt_xlog_t *xlog;
+  TypedData_Get_Struct(self, lwt_xlog_t, &lwt_xlog_type, xlog);
+
+  FilePathValue(path);
+
+  if (xlog->map != NULL)
+    rb_raise(lwt_eXlogError, "file is already open");
+
+  int fd = open(RSTRING_PTR(path), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    rb_sys_fail_str(path);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int e = errno;
+    close(fd);
+    errno = e;
+    rb_sys_fail_str(path);
+  }
+
+  if (st.st_size == 0) {
+    close(fd);
+    rb_raise(lwt_eXlogError, "%"PRIsVALUE" is empty", path);
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int e = errno;
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    errno = e;
+    rb_sys_fail_str(path);
+  }
+
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  xlog->map = map;
+  xlog->map_size = st.st_size;
+
+  const char *pos = xlog->map;
+  const char *end = pos + xlog->map_size;
+  VALUE meta = rb_hash_new();
+  int line = 0;
+
+  while (1) {
+    const char *eol = memchr(pos, '\n', end - pos);
+    if (eol == NULL) {
+      lwt_xlog_unmap(xlog);
+      rb_raise(lwt_eXlogError, "%"PRIsVALUE" has no meta block", path);
+    }
+
+    if (eol == pos) {
+      pos++;
+      break;
+    }
+
+    if (line == 0) {
+      rb_hash_aset(meta, rb_str_new_cstr("type"), rb_str_new(pos, eol - pos));
+    } else if (line == 1) {
+      rb_hash_aset(meta, rb_str_new_cstr("version"), rb_str_new(pos, eol - pos));
+    } else {
+      const char *sep = memchr(pos, ':', eol - pos);
+      if (sep != NULL) {
+        const char *val = sep + 1;
+        while (val < eol && *val == ' ')
+          val++;
+        rb_hash_aset(meta, rb_str_new(pos, sep - pos), rb_str_new(val, eol - val));
+      }
+    }
+
+    line++;
+    pos = eol + 1;
+  }
+
+  xlog->rows = pos;
+
+  return meta;
+}
+
+static int
+lwt_xlog_add_tx(lwt_xlog_t *xlog, const char *data, size_t size, int owned) {
+  if (xlog->ntxs == xlog->txs_capa) {
+    size_t capa = xlog->txs_capa ? xlog->txs_capa * 2 : 64;
+    lwt_xlog_tx_t *txs = realloc(xlog->txs, capa * sizeof(lwt_xlog_tx_t));
+    if (txs == NULL)
+      return -1;
+    xlog->txs = txs;
+    xlog->txs_capa = capa;
+  }
+
+  xlog->txs[xlog->ntxs].data = data;
+  xlog->txs[xlog->ntxs].size = size;
+  xlog->txs[xlog->ntxs].owned = owned;
+  xlog->ntxs++;
+
+  return 0;
+}
+
+#ifdef HAVE_ZSTD_H
+static const char *
+lwt_xlog_decompress(const char *src, size_t len, size_t *size) {
+  ZSTD_DStream *zstd = ZSTD_createDStream();
+  if (zstd == NULL)
+    return NULL;
+
+  ZSTD_initDStream(zstd);
+
+  size_t capa = len * 4;
+  char *buf = malloc(capa);
+  ZSTD_inBuffer in = {src, len, 0};
+  ZSTD_outBuffer out = {buf, capa, 0};
+  size_t rc = 1;
+
+  // rc is 0 when a frame is completely decoded and flushed
+  while (buf != NULL && rc != 0) {
+    if (out.pos == out.size) {
+      char *grown = realloc(buf, capa * 2);
+      if (grown == NULL) {
+        free(buf);
+        buf = NULL;
+        break;
+      }
+      buf = grown;
+      capa *= 2;
+      out.dst = buf;
+      out.size = capa;
+    }
+
+    rc = ZSTD_decompressStream(zstd, &out, &in);
+    if (ZSTD_isError(rc) || (rc != 0 && in.pos == in.size && out.pos < out.size)) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+
+  ZSTD_freeDStream(zstd);
+
+  *size = out.pos;
+  return buf;
+}
+#endif
+
+static void *
+lwt_xlog_prepare_nogvl(void *arg) {
+  lwt_xlog_t *xlog = arg;
+  const char *pos = xlog->rows;
+  const char *end = xlog->map + xlog->map_size;
+
+  while (end - pos >= 4) {
+    if (memcmp(pos, lwt_xlog_eof_marker, 4) == 0) {
+      xlog->eof = 1;
+      break;
+    }
+
+    int compressed = memcmp(pos, lwt_xlog_zrow_marker, 4) == 0;
+    if (!compressed && memcmp(pos, lwt_xlog_row_marker, 4) != 0) {
+      xlog->error = "bad transaction marker";
+      return NULL;
+    }
+
+    // the last transaction of an xlog which is being written may be incomplete
+    if (end - pos < LWT_XLOG_FIXHEADER_SIZE)
+      break;
+
+    const char *p = pos + 4;
+    const char *header_end = pos + LWT_XLOG_FIXHEADER_SIZE;
+    uint64_t len = 0;
+    int i;
+
+    // length, crc32c of the previous transaction and of this one
+    for (i = 0; i < 3; i++) {
+      const char *value = p;
+      if (p >= header_end || mp_typeof(*p) != MP_UINT || mp_check(&p, header_end) != 0) {
+        xlog->error = "bad transaction header";
+        return NULL;
+      }
+      if (i == 0)
+        len = mp_decode_uint(&value);
+    }
+
+    if (p < header_end && (mp_typeof(*p) != MP_STR || mp_check(&p, header_end) != 0 || p != header_end)) {
+      xlog->error = "bad transaction header";
+      return NULL;
+    }
+
+    pos = header_end;
+    if ((uint64_t)(end - pos) < len)
+      break;
+
+    if (compressed) {
+#ifdef HAVE_ZSTD_H
+      size_t size;
+      const char *data = lwt_xlog_decompress(pos, len, &size);
+      if (data == NULL) {
+        xlog->error = "can't decompress transaction";
+        return NULL;
+      }
+      if (lwt_xlog_add_tx(xlog, data, size, 1) < 0) {
+        free((void *)data);
+        xlog->error = "out of memory";
+        return NULL;
+      }
+#else
+      xlog->error = "compressed transactions need lwtarantool built with zstd";
+      return NULL;
+#endif
+    } else if (lwt_xlog_add_tx(xlog, pos, len, 0) < 0) {
+      xlog->error = "out of memory";
+      return NULL;
+    }
+
+    pos += len;
+  }
+
+  xlog->prepared = 1;
+  return NULL;
+}
+
+static void
+lwt_xlog_do_prepare(VALUE self, lwt_xlog_t *xlog) {
+  if (xlog->prepared)
+    return;
+
+  if (xlog->busy)
+    rb_raise(lwt_eXlogError, "file is used by another thread");
+
+  xlog->busy = 1;
+  xlog->error = NULL;
+  lwt_xlog_free_txs(xlog);
+
+  rb_thread_call_without_gvl(lwt_xlog_prepare_nogvl, xlog, NULL, NULL);
+  xlog->busy = 0;
+
+  if (xlog->error != NULL) {
+    lwt_xlog_free_txs(xlog);
+    rb_raise(lwt_eXlogError, "%s", xlog->error);
+  }
+}
+
+/*
+ * Document-class: LWTarantool::Xlog
+ *
+ * Scan (and decompress) transactions of the file.
+ *
+ * GVL is released while preparing, so several files can be prepared by
+ * threads in parallel. Files are prepared on first iteration otherwise.
+ *
+ * @return [LWTarantool::Xlog] self.
+ *
+ * @raise [LWTarantool::XlogError] the file is corrupted or closed.
+ */
+static VALUE
+lwt_xlog_prepare(VALUE self) {
+  lwt_xlog_do_prepare(self, lwt_xlog_get(self));
+
+  return self;
+}
+
+typedef struct {
+  VALUE self;
+  VALUE filter;
+  int rows;
+  int flags;
+} lwt_xlog_iter_t;
+
+static VALUE
+lwt_xlog_iterate(VALUE arg) {
+  lwt_xlog_iter_t *it = (lwt_xlog_iter_t *)arg;
+  lwt_xlog_t *xlog = lwt_xlog_get(it->self);
+  lwt_xrow_t row;
+  size_t i;
+
+  for (i = 0; i < xlog->ntxs; i++) {
+    const char *pos = xlog->txs[i].data;
+    const char *end = pos + xlog->txs[i].size;
+
+    while (pos < end) {
+      const char *check = pos;
+      if (mp_typeof(*pos) != MP_MAP || mp_check(&check, end) != 0)
+        rb_raise(lwt_eXlogError, "bad row header");
+
+      pos = lwt_xrow_decode_header(&row, pos);
+
+      if (pos < end && row.type != LWT_XROW_NOP) {
+        check = pos;
+        if (mp_check(&check, end) != 0)
+          rb_raise(lwt_eXlogError, "bad row body");
+        lwt_xrow_decode_body(&row, pos);
+        pos = check;
+      }
+
+      // space id is checked before anything is decoded
+      if (!lwt_xrow_match(&row, it->filter))
+        continue;
+
+      if (it->rows) {
+        rb_yield(lwt_xrow_to_hash(&row, it->flags));
+      } else if (row.tuple != NULL && (row.type == TNT_OP_INSERT || row.type == TNT_OP_REPLACE)) {
+        const char *tuple = row.tuple;
+        rb_yield(lwt_unpack(&tuple, it->flags));
+      }
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+lwt_xlog_iterate_done(VALUE self) {
+  lwt_xlog_t *xlog;
+  TypedData_Get_Struct(self, lwt_xlog_t, &lwt_xlog_type, xlog);
+
+  xlog->busy = 0;
+
+  return Qnil;
+}
+
+/*
+ * Yield tuples (rows is false) or row hashes of all transactions.
+ *
+ * The file is marked busy while iterating, so it isn't unmapped by a block.
+ */
+static VALUE
+lwt_xlog_each(VALUE self, VALUE filter, VALUE rows, VALUE symbolize_keys, VALUE freeze) {
+  lwt_xlog_t *xlog = lwt_xlog_get(self);
+
+  lwt_xrow_check_filter(filter);
+
+  lwt_xlog_do_prepare(self, xlog);
+
+  if (xlog->busy)
+    rb_raise(lwt_eXlogError, "file is used by another thread");
+
+  lwt_xlog_iter_t it = {self, filter, RTEST(rows), 0};
+  if (RTEST(symbolize_keys))
+    it.flags |= LWT_UNPACK_SYMBOLIZE_KEYS;
+  if (RTEST(freeze))
+    it.flags |= LWT_UNPACK_FREEZE;
+
+  xlog->busy = 1;
+  rb_ensure(lwt_xlog_iterate, (VALUE)&it, lwt_xlog_iterate_done, self);
+
+  return self;
+}
+
+/*
+ * Document-class: LWTarantool::Xlog
+ *
+ * Check if the file ends with EOF marker.
+ *
+ * An xlog which is being written by Tarantool doesn't have it yet.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+lwt_xlog_is_complete(VALUE self) {
+  lwt_xlog_t *xlog = lwt_xlog_get(self);
+
+  lwt_xlog_do_prepare(self, xlog);
+
+  return xlog->eof ? Qtrue : Qfalse;
+}
+
+/*
+ * Document-class: LWTarantool::Xlog
+ *
+ * Unmap the file.
+ *
+ * @raise [LWTarantool::XlogError] the file is used by another thread.
+ */
+static VALUE
+lwt_xlog_close(VALUE self) {
+  lwt_xlog_t *xlog;
+  TypedData_Get_Struct(self, lwt_xlog_t, &lwt_xlog_type, xlog);
+
+  if (xlog->busy)
+    rb_raise(lwt_eXlogError, "file is used by another thread");
+
+  lwt_xlog_unmap(xlog);
+
+  return Qnil;
+}
+
+/*
+ * Document-class: LWTarantool::Xlog
+ *
+ * Check if the file is closed.
+ *
+ * @return [Boolean]
+ */
+static VALUE
+lwt_xlog_is_closed(VALUE self) {
+  lwt_xlog_t *xlog;
+  TypedData_Get_Struct(self, lwt_xlog_t, &lwt_xlog_type, xlog);
+
+  return xlog->map == NULL ? Qtrue : Qfalse;
+}
+
+void init_xlog() {
+  /*
+   * Document-class: LWTarantool::Xlog
+   *
+   * Reader of Tarantool xlog files.
+   */
+  lwt_cXlog = rb_define_class_under(lwt_Class, "Xlog", rb_cObject);
+  lwt_eXlogError = rb_define_class_under(lwt_Class, "XlogError", lwt_eError);
+
+  /*
+   * Document-const: LWTarantool::Xlog::ZSTD
+   *
+   * True if compressed transactions can be read (the gem is built with libzstd).
+   */
+#ifdef HAVE_ZSTD_H
+  rb_define_const(lwt_cXlog, "ZSTD", Qtrue);
+#else
+  rb_define_const(lwt_cXlog, "ZSTD", Qfalse);
+#endif
+
+  rb_define_alloc_func(lwt_cXlog, lwt_xlog_alloc);
+  rb_define_method(lwt_cXlog, "prepare", lwt_xlog_prepare, 0);
+  rb_define_method(lwt_cXlog, "complete?", lwt_xlog_is_complete, 0);
+  rb_define_method(lwt_cXlog, "close", lwt_xlog_close, 0);
+  rb_define_method(lwt_cXlog, "closed?", lwt_xlog_is_closed, 0);
+  rb_define_private_method(lwt_cXlog, "_open", lwt_xlog_open, 1);
+  rb_define_private_method(lwt_cXlog, "_each", lwt_xlog_each, 4);
+}
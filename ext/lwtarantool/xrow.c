@@ -0,0 +1,175 @@
+#include <ruby.h>
+#include <msgpuck.h>
+#include <string.h>
+#include <tarantool/tnt_proto.h>
+#include "lwtarantool.h"
+
+/*
+ * Rows of xlog files and of replication stream.
+ *
+ * Both are a msgpack header map followed by a body map with the usual
+ * IPROTO request keys, so they are decoded the same way. Body fields are
+ * kept as pointers into the row and only the requested ones are turned
+ * into Ruby objects.
+ */
+
+// xrow header keys
+#define LWT_XROW_TYPE 0x00
+#define LWT_XROW_REPLICA_ID 0x02
+#define LWT_XROW_LSN 0x03
+#define LWT_XROW_TIMESTAMP 0x04
+
+static uint64_t
+lwt_xrow_key(const char **pos) {
+  if (mp_typeof(**pos) == MP_UINT)
+    return mp_decode_uint(pos);
+
+  mp_next(pos);
+  return UINT64_MAX;
+}
+
+/*
+ * Decode header map, which must be already checked by mp_check().
+ *
+ * Body fields of the row are reset. Returns position after the header.
+ */
+const char *
+lwt_xrow_decode_header(lwt_xrow_t *row, const char *pos) {
+  memset(row, 0, sizeof(*row));
+
+  uint32_t n = mp_decode_map(&pos);
+
+  while (n-- > 0) {
+    uint64_t k = lwt_xrow_key(&pos);
+
+    if (k == LWT_XROW_TYPE && mp_typeof(*pos) == MP_UINT)
+      row->type = mp_decode_uint(&pos);
+    else if (k == LWT_XROW_LSN && mp_typeof(*pos) == MP_UINT)
+      row->lsn = mp_decode_uint(&pos);
+    else if (k == LWT_XROW_REPLICA_ID && mp_typeof(*pos) == MP_UINT)
+      row->replica_id = mp_decode_uint(&pos);
+    else if (k == LWT_XROW_TIMESTAMP && mp_typeof(*pos) == MP_DOUBLE)
+      row->timestamp = mp_decode_double(&pos);
+    else
+      mp_next(&pos);
+  }
+
+  return pos;
+}
+
+/*
+ * Find fields of body map, which must be already checked by mp_check().
+ */
+void
+lwt_xrow_decode_body(lwt_xrow_t *row, const char *pos) {
+  uint32_t n = 0;
+
+  if (mp_typeof(*pos) == MP_MAP)
+    n = mp_decode_map(&pos);
+
+  while (n-- > 0) {
+    uint64_t k = lwt_xrow_key(&pos);
+
+    if (k == TNT_SPACE && mp_typeof(*pos) == MP_UINT) {
+      row->space = mp_decode_uint(&pos);
+      row->has_space = 1;
+      continue;
+    }
+
+    if (k == TNT_INDEX && mp_typeof(*pos) == MP_UINT) {
+      row->index = mp_decode_uint(&pos);
+      row->has_index = 1;
+      continue;
+    }
+
+    if (k == TNT_TUPLE)
+      row->tuple = pos;
+    else if (k == TNT_KEY)
+      row->key = pos;
+    else if (k == TNT_OPS)
+      row->ops = pos;
+    else if (k == TNT_VCLOCK)
+      row->vclock = pos;
+    else if (k == TNT_ERROR)
+      row->error = pos;
+
+    mp_next(&pos);
+  }
+}
+
+/*
+ * Check space filter argument: nil, an Integer or an Array of them.
+ */
+void
+lwt_xrow_check_filter(VALUE filter) {
+  if (!NIL_P(filter) && TYPE(filter) != T_ARRAY && !RB_INTEGER_TYPE_P(filter))
+    rb_raise(rb_eArgError, "space must be an Integer or an Array of them");
+}
+
+/*
+ * Check if row space matches the filter, rows without space match nil only.
+ */
+int
+lwt_xrow_match(const lwt_xrow_t *row, VALUE filter) {
+  long i;
+
+  if (NIL_P(filter))
+    return 1;
+
+  if (!row->has_space)
+    return 0;
+
+  if (TYPE(filter) != T_ARRAY)
+    return NUM2ULL(filter) == row->space;
+
+  for (i = 0; i < RARRAY_LEN(filter); i++) {
+    if (NUM2ULL(RARRAY_AREF(filter, i)) == row->space)
+      return 1;
+  }
+
+  return 0;
+}
+
+static VALUE
+lwt_xrow_type(uint64_t type) {
+  switch (type) {
+    case TNT_OP_INSERT: return ID2SYM(rb_intern("insert"));
+    case TNT_OP_REPLACE: return ID2SYM(rb_intern("replace"));
+    case TNT_OP_UPDATE: return ID2SYM(rb_intern("update"));
+    case TNT_OP_DELETE: return ID2SYM(rb_intern("delete"));
+    case TNT_OP_UPSERT: return ID2SYM(rb_intern("upsert"));
+    case LWT_XROW_NOP: return ID2SYM(rb_intern("nop"));
+  }
+
+  return ULL2NUM(type);
+}
+
+/*
+ * Row as a Hash with :type, :lsn, :replica_id, :timestamp and request fields.
+ *
+ * Update operations are sent as tuple field, so they are reported as :ops.
+ */
+VALUE
+lwt_xrow_to_hash(const lwt_xrow_t *row, int flags) {
+  VALUE hash = rb_hash_new();
+  const char *pos;
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("type")), lwt_xrow_type(row->type));
+  rb_hash_aset(hash, ID2SYM(rb_intern("lsn")), ULL2NUM(row->lsn));
+  rb_hash_aset(hash, ID2SYM(rb_intern("replica_id")), ULL2NUM(row->replica_id));
+  rb_hash_aset(hash, ID2SYM(rb_intern("timestamp")), DBL2NUM(row->timestamp));
+
+  if (row->has_space)
+    rb_hash_aset(hash, ID2SYM(rb_intern("space")), ULL2NUM(row->space));
+  if (row->has_index)
+    rb_hash_aset(hash, ID2SYM(rb_intern("index")), ULL2NUM(row->index));
+
+  if ((pos = row->key) != NULL)
+    rb_hash_aset(hash, ID2SYM(rb_intern("key")), lwt_unpack(&pos, flags));
+  if ((pos = row->tuple) != NULL)
+    rb_hash_aset(hash, ID2SYM(rb_intern(row->type == TNT_OP_UPDATE ? "ops" : "tuple")), lwt_unpack(&pos, flags));
+  if ((pos = row->ops) != NULL)
+    rb_hash_aset(hash, ID2SYM(rb_intern("ops")), lwt_unpack(&pos, flags));
+
+  return hash;
+}
@@ -1,8 +1,18 @@
 # frozen_string_literal: true
 
 require 'lwtarantool/lwtarantool'
+require 'lwtarantool/batch'
+require 'lwtarantool/call_cache'
 require 'lwtarantool/connection'
+require 'lwtarantool/flusher'
+require 'lwtarantool/pager'
+require 'lwtarantool/pool'
+require 'lwtarantool/reply'
 require 'lwtarantool/request'
+require 'lwtarantool/xlog'
+require 'lwtarantool/snapshot'
+require 'lwtarantool/statement'
+require 'lwtarantool/subscriber'
 
 ## LWTarantool
 #
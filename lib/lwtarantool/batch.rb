@@ -0,0 +1,27 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Collector of function calls for {LWTarantool::Connection#batch}.
+  class Batch
+    # @return [Array<Array(String, Array)>] collected calls.
+    attr_reader :calls
+
+    # @api private
+    def initialize
+      @calls = []
+    end
+
+    #
+    # Add a function call to the batch.
+    #
+    # @param [String] func the tarantool function for call.
+    # @param [Array] args the tarantool function arguments.
+    #
+    # @return [LWTarantool::Batch] self.
+    #
+    def call(func, args)
+      @calls << [func, args]
+      self
+    end
+  end
+end
@@ -0,0 +1,170 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Coalescing and caching of idempotent function calls.
+  #
+  # Calls are identified by function name and msgpack encoded args, so they
+  # are compared without decoding. A call which is already in flight is
+  # shared by identical calls. Successful replies are kept in LRU order for
+  # ttl seconds since the request was sent, and the oldest ones are evicted
+  # when the total size of keys and reply buffers exceeds the byte limit.
+  #
+  # Shared requests ignore {LWTarantool::Request#release}, their buffers are
+  # freed by GC after eviction.
+  #
+  # @api private
+  class CallCache
+    # Estimated memory used by an entry besides key and reply buffer.
+    ENTRY_OVERHEAD = 128
+
+    Entry = Struct.new(:req, :expires_at, :bytes)
+
+    #
+    # Cache for connection options, nil if no idempotent functions declared.
+    #
+    def self.for(options)
+      functions = options[:idempotent]
+      return if functions.nil? || functions.empty?
+
+      new(functions, bytes: options[:cache_bytes] || 0, ttl: options[:cache_ttl] || 1)
+    end
+
+    def initialize(functions, bytes: 0, ttl: 1)
+      raise ArgumentError, 'cache_bytes must be a non-negative Integer' unless bytes.is_a?(Integer) && bytes >= 0
+      raise ArgumentError, 'cache_ttl must be a positive Numeric' unless ttl.is_a?(Numeric) && ttl.positive?
+
+      @functions = functions.map(&:to_s).to_h { |f| [f, true] }.freeze
+      @max_bytes = bytes
+      @ttl = ttl
+      @mutex = Mutex.new
+      @sent = ConditionVariable.new
+      @in_flight = {}
+      @cached = {}
+      @bytes = 0
+      @hits = 0
+      @misses = 0
+      @coalesced = 0
+      @evictions = 0
+    end
+
+    def idempotent?(func)
+      @functions.key?(func)
+    end
+
+    #
+    # Return a cached or in flight request of the call or send a new one.
+    #
+    # The block sends the request without the cache lock, so calls of
+    # other keys aren't held by it. An entry without request is put in
+    # flight before, identical calls wait for it and never overtake it.
+    #
+    def fetch(func, args)
+      key = [func, args].freeze
+      entry = lookup(key) { |req| return req }
+
+      req = nil
+      begin
+        req = yield
+      ensure
+        @mutex.synchronize do
+          if req
+            entry.req = req.share
+          else
+            # a failed call is dropped, a waiting identical call sends itself
+            @in_flight.delete(key)
+          end
+          @sent.broadcast
+        end
+      end
+      req
+    end
+
+    def fill_stats(stats)
+      @mutex.synchronize do
+        settle(clock)
+        stats[:call_cache_hits] = @hits
+        stats[:call_cache_misses] = @misses
+        stats[:call_coalesced] = @coalesced
+        stats[:call_cache_evictions] = @evictions
+        stats[:call_cache_entries] = @cached.size
+        stats[:call_cache_bytes] = @bytes
+      end
+      stats
+    end
+
+    private
+
+    # Yield a cached or in flight request, otherwise put an entry without
+    # request in flight and return it.
+    def lookup(key)
+      @mutex.synchronize do
+        loop do
+          now = clock
+          settle(now)
+
+          entry = @in_flight[key]
+          if entry && entry.req.nil?
+            # being sent by another caller
+            @sent.wait(@mutex)
+            next
+          end
+
+          if entry && !entry.req.ready?
+            @coalesced += 1
+            yield entry.req
+          end
+          complete(key, now) if entry
+
+          if (entry = @cached.delete(key))
+            if entry.expires_at > now
+              @cached[key] = entry
+              @hits += 1
+              yield entry.req
+            end
+
+            @bytes -= entry.bytes
+          end
+
+          @misses += 1
+          break @in_flight[key] = Entry.new(nil, now + @ttl, 0)
+        end
+      end
+    end
+
+    # Move completed requests to cache, replies usually come in order,
+    # so only the oldest in flight requests are checked.
+    def settle(now)
+      loop do
+        key, entry = @in_flight.first
+        break unless entry&.req&.ready?
+
+        complete(key, now)
+      end
+    end
+
+    # Cache a completed request if it succeeded and isn't expired yet.
+    def complete(key, now)
+      entry = @in_flight.delete(key)
+      return if @max_bytes.zero? || entry.expires_at <= now || entry.req.error
+
+      entry.bytes = key[0].bytesize + key[1].bytesize + entry.req.bytesize + ENTRY_OVERHEAD
+      return if entry.bytes > @max_bytes
+
+      @cached[key] = entry
+      @bytes += entry.bytes
+      evict
+    end
+
+    def evict
+      while @bytes > @max_bytes
+        _, entry = @cached.shift
+        @bytes -= entry.bytes
+        @evictions += 1
+      end
+    end
+
+    def clock
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+  end
+end
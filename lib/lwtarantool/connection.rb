@@ -1,5 +1,6 @@
 # frozen_string_literal: true
 
+require 'io/wait'
 require 'msgpack'
 
 module LWTarantool
@@ -7,17 +8,61 @@ module LWTarantool
   class Connection
     # attr_accessor :logger
 
+    # Select iterator types by name.
+    ITERATORS = {
+      eq: 0,
+      req: 1,
+      all: 2,
+      lt: 3,
+      le: 4,
+      ge: 5,
+      gt: 6,
+      bits_all_set: 7,
+      bits_any_set: 8,
+      bits_all_not_set: 9,
+      overlaps: 10,
+      neighbor: 11
+    }.freeze
+
+    # System space with space definitions visible to the user.
+    VSPACE_ID = 281
+
+    # System space with index definitions visible to the user.
+    VINDEX_ID = 289
+
+    # Maximum number of cached SQL statements.
+    STATEMENT_CACHE_SIZE = 256
+
+    # Options passed to standby connection, the others don't affect transport.
+    STANDBY_OPTIONS = %i[recv_buf_size send_buf_size connect_timeout open_timeout nonblock].freeze
+
+    # Reply hook of on_reply: :active_support option.
+    ACTIVE_SUPPORT_HOOK = lambda do |req|
+      ActiveSupport::Notifications.instrument('reply.lwtarantool',
+                                              request: req, function: req.function, latency: req.latency)
+    end
+
     # Call a function in tarantool.
     #
     # Connection can be one-time reestablished in case of fail.
     #
+    # Calls of functions declared with idempotent option are identified by
+    # encoded args. An identical call in flight is shared instead of sending
+    # a new request (with the timeout of the first call), and with cache_bytes
+    # option a successful reply is reused for cache_ttl seconds.
+    #
     # @param [String] func the tarantool function for call.
     # @param [Array] args the tarantool function arguments.
+    # @param [Numeric] timeout seconds to wait for response, defaults to
+    #   connection timeout option. Request fails with "Request timed out"
+    #   error after it, and its late response is dropped.
     #
     # @example
     #   conn.call('box.slab.info', [])
+    #   conn.call('slow_function', [], timeout: 0.5)
     #
-    # @return [LWTarantool::Request] a new request instance.
+    # @return [LWTarantool::Request] a new request instance, or a shared one
+    #   for an idempotent function.
     #
     # @raise [LWTarantool::ResolvError] destination host can't be resolved.
     # @raise [LWTarantool::TimeoutError] connect timeout reached.
@@ -26,17 +71,344 @@ module LWTarantool
     # @raise [LWTarantool::TooLargeRequestError] request is larger than connection send buffer.
     # @raise [LWTarantool::UnknownError] unknown error.
     #
-    def call(func, args)
-      mutex.synchronize do
-        _connect unless connected?
-        _call(func, args.to_msgpack)
+    def call(func, args, timeout: self.timeout)
+      args = pack_args(args)
+      return request(timeout) { named(_call(func, args), func) } unless call_cache&.idempotent?(func)
+
+      args = _pack(args) unless args.is_a?(String)
+      call_cache.fetch(func, args) { request(timeout) { named(_call(func, args), func) } }
+    end
+
+    #
+    # Call several functions in tarantool at once.
+    #
+    # All requests are encoded into connection send buffer and sent together,
+    # so a batch costs a single system call instead of one per request.
+    #
+    # Connection can be one-time reestablished in case of fail.
+    #
+    # @param [Array<Array(String, Array)>] calls pairs of function name and
+    #   function arguments.
+    # @param [Numeric] timeout seconds to wait for responses (see #call).
+    #
+    # @example
+    #   reqs = conn.call_many([['box.slab.info', []], ['box.info', []]])
+    #   reqs.map(&:result)
+    #
+    # @return [Array<LWTarantool::Request>] new request instances in the same
+    #   order as calls.
+    #
+    # @raise (see #call)
+    #
+    def call_many(calls, timeout: self.timeout)
+      calls = calls.map { |func, args| [func, pack_args(args)] }
+      request(timeout) do
+        _call_many(calls).each_with_index { |req, i| named(req, calls[i][0]) }
       end
-    rescue SystemError
-      attempt ||= 0
-      attempt += 1
-      disconnect
-      retry if attempt <= 1
-      raise
+    end
+
+    #
+    # Select tuples from a space.
+    #
+    # Request is encoded natively, without calling a Lua function.
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Array, Object] key the index key, a single part key may be
+    #   passed as is.
+    # @param [Integer, String, Symbol] index the index id or name.
+    # @param [Symbol, Integer] iterator the iterator type (see ITERATORS).
+    # @param [Integer] limit maximum number of tuples, unlimited by default.
+    # @param [Integer] offset number of tuples to skip.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.select(512, 1).result
+    #   conn.select(:users, [10], index: :age, iterator: :ge, limit: 100).result
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an Array of tuples.
+    #
+    # @raise [ArgumentError] unknown iterator or invalid argument.
+    # @raise [LWTarantool::SchemaError] unknown space or index name.
+    # @raise (see #call)
+    #
+    def select(space, key = [], index: 0, iterator: :eq, limit: nil, offset: 0, timeout: self.timeout)
+      space, index = space_id(space), index_id(space, index)
+      key = pack_key(key)
+      iterator = ITERATORS.fetch(iterator) { raise ArgumentError, "unknown iterator #{iterator}" } if iterator.is_a?(Symbol)
+      request(timeout) { _select(space, index, key, iterator, limit || 0xFFFFFFFF, offset) }
+    end
+
+    #
+    # Iterate over selected tuples fetching them by pages.
+    #
+    # Pages are selected with limit and offset, the next page is requested
+    # while the current one is processed (see {LWTarantool::Pager}).
+    #
+    # @param (see #select)
+    # @param [Integer] page_size number of tuples in a page.
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @example
+    #   conn.select_each(:users, [], iterator: :all, page_size: 10_000) { |tuple| process(tuple) }
+    #
+    # @yieldparam [Array] tuple a selected tuple.
+    #
+    # @return [LWTarantool::Pager] tuples enumerator if no block is given.
+    #
+    # @raise [LWTarantool::Error] a page request failed.
+    # @raise (see #select)
+    #
+    def select_each(space, key = [], page_size: 1000, symbolize_keys: false, freeze: false, **options, &block)
+      pager = pages(page_size: page_size, symbolize_keys: symbolize_keys, freeze: freeze) do |offset, limit|
+        select(space, key, **options, offset: offset, limit: limit)
+      end
+      block ? pager.each(&block) : pager
+    end
+
+    #
+    # Make an enumerator over a result fetched by pages.
+    #
+    # @param [Integer] page_size number of tuples in a page.
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @yieldparam [Integer] offset number of tuples to skip.
+    # @yieldparam [Integer] limit maximum number of tuples in a page.
+    # @yieldreturn [LWTarantool::Request] request of a page.
+    #
+    # @example
+    #   conn.pages(page_size: 500) { |offset, limit| conn.call('events', [offset, limit]) }.each do |event|
+    #     process(event)
+    #   end
+    #
+    # @return [LWTarantool::Pager]
+    #
+    def pages(page_size: 1000, symbolize_keys: false, freeze: false, &fetch)
+      Pager.new(page_size, symbolize_keys: symbolize_keys, freeze: freeze, &fetch)
+    end
+
+    #
+    # Insert a tuple into a space.
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Array] tuple the tuple to insert.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.insert(512, [1, 'name'])
+    #   conn.insert(:users, [1, 'name'])
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an Array with the inserted tuple.
+    #
+    # @raise (see #call)
+    #
+    def insert(space, tuple, timeout: self.timeout)
+      space = space_id(space)
+      tuple = pack_args(tuple)
+      request(timeout) { _insert(space, tuple) }
+    end
+
+    #
+    # Insert or replace a tuple in a space.
+    #
+    # @param (see #insert)
+    #
+    # @example
+    #   conn.replace(512, [1, 'name'])
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an Array with the new tuple.
+    #
+    # @raise (see #call)
+    #
+    def replace(space, tuple, timeout: self.timeout)
+      space = space_id(space)
+      tuple = pack_args(tuple)
+      request(timeout) { _replace(space, tuple) }
+    end
+
+    #
+    # Update a tuple by key.
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Array, Object] key the unique index key.
+    # @param [Array<Array>] ops update operations, e.g. ['=', 2, 'x'].
+    # @param [Integer, String, Symbol] index the unique index id or name.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.update(512, 1, [['+', 2, 1]])
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an Array with the updated tuple or an empty Array.
+    #
+    # @raise (see #call)
+    #
+    def update(space, key, ops, index: 0, timeout: self.timeout)
+      space, index = space_id(space), index_id(space, index)
+      key = pack_key(key)
+      ops = pack_args(ops)
+      request(timeout) { _update(space, index, key, ops) }
+    end
+
+    #
+    # Insert a tuple or update an existing one.
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Array] tuple the tuple to insert.
+    # @param [Array<Array>] ops update operations for an existing tuple.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.upsert(512, [1, 0], [['+', 2, 1]])
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an empty Array.
+    #
+    # @raise (see #call)
+    #
+    def upsert(space, tuple, ops, timeout: self.timeout)
+      space = space_id(space)
+      tuple = pack_args(tuple)
+      ops = pack_args(ops)
+      request(timeout) { _upsert(space, tuple, ops) }
+    end
+
+    #
+    # Delete a tuple by key.
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Array, Object] key the unique index key.
+    # @param [Integer, String, Symbol] index the unique index id or name.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.delete(512, 1)
+    #
+    # @return [LWTarantool::Request] a new request instance, its result is
+    #   an Array with the deleted tuple or an empty Array.
+    #
+    # @raise (see #call)
+    #
+    def delete(space, key, index: 0, timeout: self.timeout)
+      space, index = space_id(space), index_id(space, index)
+      key = pack_key(key)
+      request(timeout) { _delete(space, index, key) }
+    end
+
+    #
+    # Execute an SQL statement.
+    #
+    # Request result holds rows, {LWTarantool::Request#metadata} describes
+    # their columns and {LWTarantool::Request#sql_info} describes changes.
+    # Statements are cached by text, so column description of a repeated
+    # query isn't decoded again.
+    #
+    # @param [String] sql the SQL statement.
+    # @param [Array] binds values of statement parameters.
+    # @param [Numeric] timeout seconds to wait for response (see #call).
+    #
+    # @example
+    #   conn.execute('SELECT * FROM users WHERE id > ?', [10]).result
+    #   conn.execute('SELECT id, name FROM users', []).columns
+    #
+    # @return [LWTarantool::Request] a new request instance.
+    #
+    # @raise (see #call)
+    #
+    def execute(sql, binds = [], timeout: self.timeout)
+      binds = pack_args(binds)
+      req = request(timeout) { _execute(sql, binds) }
+      req.statement = statement(sql)
+      req
+    end
+
+    #
+    # Resolve a space name into id.
+    #
+    # Names are resolved with a schema cache, which is loaded on first use
+    # and reloaded only when a reply brings a new schema version, so
+    # resolving doesn't cost a round-trip. An unknown name causes a single
+    # reload, the space may be created by another client.
+    #
+    # @param [Integer, String, Symbol] space the space name, an id is
+    #   returned as is.
+    #
+    # @example
+    #   conn.space_id(:users) # => 512
+    #
+    # @return [Integer] the space id.
+    #
+    # @raise [LWTarantool::SchemaError] unknown space or schema can't be loaded.
+    # @raise (see #call)
+    #
+    def space_id(space)
+      return space if space.is_a?(Integer)
+
+      name = space.to_s
+      with_schema { _space_id(name) } || raise(SchemaError, "Space '#{name}' does not exist")
+    end
+
+    #
+    # Resolve an index name into id (see #space_id).
+    #
+    # @param [Integer, String, Symbol] space the space id or name.
+    # @param [Integer, String, Symbol] index the index name, an id is
+    #   returned as is.
+    #
+    # @example
+    #   conn.index_id(:users, :email) # => 1
+    #
+    # @return [Integer] the index id.
+    #
+    # @raise (see #space_id)
+    #
+    def index_id(space, index)
+      return index if index.is_a?(Integer)
+
+      id = space_id(space)
+      name = index.to_s
+      with_schema { _index_id(id, name) } || raise(SchemaError, "No index '#{name}' in space '#{space}'")
+    end
+
+    #
+    # Load schema cache again.
+    #
+    # @return [LWTarantool::Connection] self.
+    #
+    # @raise (see #space_id)
+    #
+    def reload_schema
+      schema_mutex.synchronize { load_schema }
+      self
+    end
+
+    #
+    # Collect function calls in a block and send them as a single batch.
+    #
+    # @yieldparam [LWTarantool::Batch] batch the batch to add calls to.
+    #
+    # @example
+    #   info, slab = conn.batch do |b|
+    #     b.call('box.info', [])
+    #     b.call('box.slab.info', [])
+    #   end
+    #
+    # Reply buffers are returned to connection pool right after results
+    # are decoded.
+    #
+    # @return [Array] results of the calls in the same order, nil for
+    #   failed calls.
+    #
+    # @raise (see #call_many)
+    #
+    def batch
+      b = Batch.new
+      yield b
+      call_many(b.calls).map { |req| req.result.tap { req.release } }
     end
 
     #
@@ -46,6 +418,10 @@ module LWTarantool
     #
     # All active requests will be terminated in case of connection fail.
     #
+    # In nonblock and multiplex modes connection isn't locked while waiting
+    # for a response, so other threads and fibers can send requests meanwhile.
+    # Only one reader waits for the socket at a time.
+    #
     # @example
     #   conn.call('box.slab.info', [])
     #
@@ -56,14 +432,180 @@ module LWTarantool
     # @raise [LWTarantool::UnknownError] unknown error.
     #
     def read
+      return notify(lock { _read }) unless shared?
+
+      read_mutex.lock
+      begin
+        read_shared
+      ensure
+        release_reader
+      end
+    rescue SystemError, LoginError
+      drop
+      raise
+    end
+
+    #
+    # Read all responses received by a single recv.
+    #
+    # Waits for the first response like {#read}, then every response which
+    # is already buffered is dispatched in the same call, so a deep pipeline
+    # is drained without a lock and a syscall per response. The receive
+    # buffer grows to fit many responses on the first use.
+    #
+    # @param [Numeric, nil] timeout seconds to wait for the first response,
+    #   nil waits until it is received.
+    #
+    # @example
+    #   reqs = Array.new(100) { |i| conn.call('get', [i]) }
+    #   conn.read_all.each { |req| process(req) } until reqs.all?(&:ready?)
+    #
+    # @return [Array<LWTarantool::Request>] processed requests, empty if
+    #   timeout is reached or no requests are in flight.
+    #
+    # @raise (see #read)
+    #
+    def read_all(timeout = nil)
+      return received(notify_all(lock { _read_all(timeout || true) })) unless shared?
+
+      read_mutex.lock
+      begin
+        read_shared_all(deadline_after(timeout))
+      ensure
+        release_reader
+      end
+    rescue SystemError, LoginError
+      drop
+      raise
+    end
+
+    #
+    # Dispatch responses which are already received, never blocks.
+    #
+    # In nonblock and multiplex modes returns nothing if another thread
+    # is reading responses.
+    #
+    # @example
+    #   conn.read_nonblock.each { |req| process(req) }
+    #
+    # @return [Array<LWTarantool::Request>] processed requests.
+    #
+    # @raise (see #read)
+    #
+    def read_nonblock
+      return received(notify_all(lock { _read_all(false) })) unless shared?
+      return [] unless read_mutex.try_lock
+
+      begin
+        received(wake_all(lock { _read_all(false) }))
+      ensure
+        release_reader
+      end
+    rescue SystemError, LoginError
+      drop
+      raise
+    end
+
+    #
+    # Wait for request be processed by Tarantool.
+    #
+    # In nonblock and multiplex modes the first waiting thread (or fiber)
+    # reads responses and wakes up waiters of the received ones, others sleep
+    # until their own response is received or they have to become a reader.
+    #
+    # Request fails with "Request timed out" error when its deadline or
+    # timeout is reached. Partially received response stays buffered,
+    # so connection remains usable.
+    #
+    # @param [LWTarantool::Request] req the request to wait for.
+    # @param [Numeric] timeout seconds to wait for.
+    #
+    # @raise [LWTarantool::SyncError] incorrect tarantool response.
+    # @raise [LWTarantool::SystemError] connection was closed.
+    # @raise [LWTarantool::UnknownError] unknown error.
+    #
+    def wait_for(req, timeout = nil)
+      deadline = [req.deadline, deadline_after(timeout)].compact.min
+      return wait_exclusive(req, deadline) unless shared?
+
+      flush_corked unless req.ready?
+
+      until req.ready?
+        break abandon(req) if expired?(deadline)
+        next unless acquire_reader(req, deadline)
+
+        begin
+          until req.ready?
+            break abandon(req) if expired?(deadline)
+
+            read_shared_all(deadline)
+          end
+        ensure
+          release_reader
+        end
+      end
+    rescue SystemError, LoginError
+      drop
+      raise
+    end
+
+    #
+    # Establish tarantool connection if it isn't established yet.
+    #
+    # @example
+    #   conn = LWTarantool.new(url: '127.0.0.1:3301', connect: false)
+    #   conn.connect
+    #
+    # @return [LWTarantool::Connection] self.
+    #
+    # Auth request is sent without waiting for its reply, incorrect login
+    # or password fails the first read with {LWTarantool::LoginError}.
+    #
+    # @raise [LWTarantool::ResolvError] destination host can't be resolved.
+    # @raise [LWTarantool::TimeoutError] connect timeout reached.
+    # @raise [LWTarantool::SystemError] connection failed.
+    #
+    def connect
       mutex.synchronize do
-        _read
+        establish unless connected?
       end
+      self
+    end
+
+    #
+    # Send corked requests right away.
+    #
+    # In corking mode requests are sent when cork window expires, when they
+    # take cork_bytes or when a reply is waited for. Without corking
+    # requests are always sent at once.
+    #
+    # @return [LWTarantool::Connection] self.
+    #
+    # @raise [LWTarantool::SystemError] connection failed.
+    #
+    def flush
+      lock { _flush }
+      self
     rescue SystemError
-      disconnect
+      drop
       raise
     end
 
+    #
+    # Get reply latency histograms of called functions.
+    #
+    # Histograms are kept with function_metrics option only.
+    #
+    # @example
+    #   conn.function_latency['box.info'].percentile(99)
+    #
+    # @return [Hash<String, LWTarantool::Histogram>, nil] copies of the
+    #   histograms by function name.
+    #
+    def function_latency
+      @function_latency&.to_h { |func, hist| [func, hist.dup] }
+    end
+
     #
     # Close tarantool connection.
     #
@@ -73,13 +615,291 @@ module LWTarantool
     #   conn.disconnect
     #
     def disconnect
+      drop
+      @standby&.disconnect
+    end
+
+    protected
+
+    #
+    # Give connected transport to a failed connection, see standby option.
+    #
+    # Doesn't wait for standby which is connecting in background, the
+    # failed connection connects itself instead.
+    #
+    # @return [Boolean] false if standby is busy, isn't connected or its
+    #   socket was closed by peer.
+    #
+    def hand_over(conn)
+      return false unless mutex.try_lock
+
+      begin
+        _hand_over(conn)
+      ensure
+        mutex.unlock
+      end
+    end
+
+    private
+
+    attr_reader :mutex, :read_mutex, :waiters_mutex, :waiters, :schema_mutex, :statements, :statements_mutex, :call_cache
+
+    def pack_args(args)
+      encoder == :native ? args : args.to_msgpack
+    end
+
+    def pack_key(key)
+      pack_args(key.is_a?(Array) ? key : [key])
+    end
+
+    # Send requests built by block and set their deadline.
+    # Connection can be one-time reestablished in case of fail.
+    def request(timeout)
+      res = lock do
+        establish unless connected?
+        yield
+      end
+      deadline = deadline_after(timeout)
+      Array(res).each { |req| req.deadline = deadline }
+      res
+    rescue SystemError
+      attempt ||= 0
+      attempt += 1
+      drop
+      retry if attempt <= 1
+      raise
+    end
+
+    # Take over standby connection if it's ready, otherwise connect.
+    # Must be called with connection lock held.
+    def establish
+      return _connect unless @standby
+
+      swapped = @standby.hand_over(self)
+      refill_standby
+      _connect unless swapped
+    end
+
+    # Close connection after a failure, keeping standby.
+    def drop
       mutex.synchronize do
         _disconnect
       end
+
+      waiters_mutex.synchronize do
+        waiters.each_key(&:wakeup)
+      end
     end
 
-    private
+    # Called by initialize with standby option.
+    def start_standby(args)
+      url = args[:standby] == true ? args[:url] : args[:standby]
+      @standby = Connection.new(args.slice(*STANDBY_OPTIONS).merge(url: url, connect: false))
+      refill_standby
+    end
+
+    # Connect standby in background, so failover doesn't wait for it.
+    def refill_standby
+      return if @standby.connected? || @standby_thread&.alive?
+
+      @standby_thread = Thread.new do
+        @standby.connect
+      rescue Error
+        nil
+      end
+    end
+
+    # Statements are kept in LRU order, a used one is moved to the end.
+    # An evicted statement stays usable by requests which hold it.
+    def statement(sql)
+      statements_mutex.synchronize do
+        if (stmt = statements.delete(sql))
+          return statements[sql] = stmt
+        end
+
+        statements.shift while statements.size >= STATEMENT_CACHE_SIZE
+        statements[sql] = Statement.new(sql.dup.freeze)
+      end
+    end
+
+    # Look a name up in schema cache, loading it if it is outdated.
+    def with_schema
+      schema_mutex.synchronize do
+        loaded = _schema_outdated? && load_schema
+        res = yield
+        res = (load_schema && yield) if res.nil? && !loaded
+        res
+      end
+    end
+
+    # Must be called with schema_mutex locked.
+    def load_schema
+      reqs = [VSPACE_ID, VINDEX_ID].map { |id| select(id, [], iterator: :all) }
+      reqs.each(&:wait)
+      _load_schema(*reqs)
+      true
+    ensure
+      reqs&.each(&:release)
+    end
+
+    def shared?
+      nonblock? || multiplex?
+    end
+
+    def clock
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+
+    def deadline_after(timeout)
+      clock + timeout if timeout
+    end
+
+    # Called by initialize in corking mode.
+    def start_flusher
+      @flusher = Flusher.new(self, @cork)
+      @flush_signal = @flusher.signal
+    end
+
+    # Let concurrent callers add their requests to the corked batch, then send it.
+    def flush_corked
+      return unless @cork
+
+      Fiber.respond_to?(:scheduler) && Fiber.scheduler ? sleep(0) : Thread.pass
+      flush
+    end
+
+    # Hold connection lock, counting time spent waiting for it.
+    def lock
+      started = clock
+      mutex.synchronize do
+        @lock_wait_time += clock - started
+        yield
+      end
+    end
+
+    # Name request by called function for metrics.
+    def named(req, func)
+      req.function = func if @function_latency || @on_reply
+      req
+    end
+
+    # Record latency of a read reply and call on_reply hook.
+    # Called out of connection lock.
+    def notify(req)
+      return req unless (@function_latency || @on_reply) && req.is_a?(Request) && req.latency
+
+      function_histogram(req.function)&.record(req.latency) if @function_latency
+      @on_reply&.call(req)
+      req
+    end
+
+    def function_histogram(func)
+      return unless func
+
+      @function_latency[func] || @metrics_mutex.synchronize { @function_latency[func] ||= Histogram.new }
+    end
+
+    def expired?(deadline)
+      deadline && clock >= deadline
+    end
+
+    def abandon(req)
+      lock { _abandon(req) }
+    end
+
+    # Read responses holding connection lock until request is processed.
+    def wait_exclusive(req, deadline)
+      until req.ready?
+        break abandon(req) if expired?(deadline)
+
+        notify_all(lock { _read_all(deadline ? [deadline - clock, 0].max : true) })
+      end
+    end
+
+    # Read a response, locking connection only while it is parsed.
+    # Must be called by reader (with read_mutex locked).
+    # Returns nil if deadline is reached.
+    def read_shared(deadline = nil)
+      loop do
+        res = lock { _read(false) }
+
+        if res == :wait_readable
+          return unless wait_readable(deadline)
+
+          next
+        end
+
+        waiters_mutex.synchronize { res.wakeup } if res
+        return notify(res)
+      end
+    end
 
-    attr_reader :mutex
+    # Read all received responses, locking connection only while they are parsed.
+    # Must be called by reader (with read_mutex locked).
+    # Returns an empty Array if deadline is reached.
+    def read_shared_all(deadline = nil)
+      loop do
+        res = lock { _read_all(false) }
+        return wake_all(res) unless res == :wait_readable
+        return [] unless wait_readable(deadline)
+      end
+    end
+
+    def wake_all(res)
+      waiters_mutex.synchronize { res.each(&:wakeup) } if res.is_a?(Array) && !res.empty?
+      notify_all(res)
+    end
+
+    def notify_all(res)
+      res.each { |req| notify(req) } if (@function_latency || @on_reply) && res.is_a?(Array)
+      res
+    end
+
+    # Responses of _read_all, or nothing if it timed out.
+    def received(res)
+      res.is_a?(Array) ? res : []
+    end
+
+    # Returns false if deadline is reached before socket becomes readable.
+    def wait_readable(deadline = nil)
+      timeout = deadline && deadline - clock
+      return false if timeout && timeout <= 0
+
+      sock = io
+      return true unless sock
+
+      !sock.wait_readable(timeout).nil?
+    rescue IOError, Errno::EBADF
+      # connection was closed by another thread, next read will notice it
+      true
+    end
+
+    # Become a reader or sleep until request is processed or reader is released.
+    def acquire_reader(req, deadline = nil)
+      waiters_mutex.synchronize do
+        return false if req.ready?
+        return true if read_mutex.try_lock
+
+        # a shared request of idempotent calls may have several waiters
+        begin
+          waiters[req] = waiters.fetch(req, 0) + 1
+          req.sleep(waiters_mutex, deadline && [deadline - clock, 0].max)
+        ensure
+          waiters[req] -= 1
+          waiters.delete(req) if waiters[req].zero?
+        end
+
+        # pass reader role to the next waiter if this one doesn't need it anymore
+        waiters.each_key.first&.wakeup if req.ready? && !read_mutex.locked?
+        false
+      end
+    end
+
+    def release_reader
+      waiters_mutex.synchronize do
+        read_mutex.unlock
+        waiters.each_key.first&.wakeup
+      end
+    end
   end
 end
@@ -0,0 +1,52 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Background sender of corked requests.
+  #
+  # A connection in corking mode pushes to {#signal} when the first request
+  # of a batch is left in its send buffer. Flusher sleeps for cork window
+  # and sends the whole batch, unless it was already sent by a waiting
+  # caller or by reaching cork_bytes.
+  #
+  # Flusher refers to its connection weakly, the thread exits when the
+  # connection is garbage collected. WeakMap is used instead of WeakRef,
+  # which can't be created outside of the main Ractor.
+  #
+  # @api private
+  class Flusher
+    # @return [Queue] signals of corked batches.
+    attr_reader :signal
+
+    def initialize(conn, window)
+      @conn = ObjectSpace::WeakMap.new
+      @conn[:conn] = conn
+      @window = window
+      @signal = Queue.new
+      ObjectSpace.define_finalizer(conn, self.class.finalizer(@signal))
+      @thread = Thread.new { run }
+    end
+
+    def self.finalizer(signal)
+      proc { signal.close }
+    end
+
+    private
+
+    def run
+      while @signal.pop
+        sleep(@window)
+        flush
+      end
+    end
+
+    def flush
+      conn = @conn[:conn]
+      return @signal.close unless conn
+
+      conn.flush
+    rescue Error
+      # callers see the error when they wait for replies
+      nil
+    end
+  end
+end
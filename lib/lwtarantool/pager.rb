@@ -0,0 +1,60 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Enumerator over a result fetched by pages, see {LWTarantool::Connection#pages}.
+  #
+  # The next page is requested as soon as the current one is received,
+  # so it is fetched while the current page is decoded and processed.
+  # Every page is released after processing, so memory is bounded by
+  # page size rather than result size.
+  class Pager
+    include Enumerable
+
+    # @return [Integer] maximum number of tuples in a page.
+    attr_reader :page_size
+
+    # @api private
+    def initialize(page_size, symbolize_keys: false, freeze: false, &fetch)
+      raise ArgumentError, 'page size must be a positive Integer' unless page_size.is_a?(Integer) && page_size.positive?
+      raise ArgumentError, 'block is required' unless fetch
+
+      @page_size = page_size
+      @decode = { symbolize_keys: symbolize_keys, freeze: freeze }
+      @fetch = fetch
+    end
+
+    #
+    # Yield tuples of all pages.
+    #
+    # Iteration stops after a page with less than page_size tuples.
+    #
+    # @yieldparam [Object] tuple a decoded tuple.
+    #
+    # @raise [LWTarantool::Error] a page request failed.
+    #
+    def each(&block)
+      return enum_for(:each) unless block
+
+      offset = 0
+      req = @fetch.call(offset, page_size)
+
+      while req
+        size = req.size
+        raise Error, req.error unless size
+
+        offset += page_size
+        following = size >= page_size ? @fetch.call(offset, page_size) : nil
+
+        begin
+          req.each_tuple(**@decode, &block)
+        ensure
+          req.release
+        end
+
+        req = following
+      end
+
+      self
+    end
+  end
+end
@@ -0,0 +1,153 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Pool of tarantool connections.
+  #
+  # Every call is routed to the connected member with the fewest requests
+  # waiting for reply. Failed members are reconnected in background, so a
+  # pool must be closed with {#close} when it isn't needed anymore.
+  class Pool
+    # Errors which mean that a member connection is broken.
+    CONNECTION_ERRORS = [ResolvError, TimeoutError, SystemError].freeze
+
+    #
+    # Member of pool.
+    #
+    # @api private
+    #
+    class Member
+      attr_reader :conn, :calls, :errors
+
+      def initialize(conn)
+        @conn = conn
+        @calls = 0
+        @errors = 0
+      end
+
+      def call(func, args, **options)
+        @calls += 1
+        conn.call(func, args, **options)
+      rescue *CONNECTION_ERRORS
+        @errors += 1
+        raise
+      end
+
+      def connect
+        conn.connect
+      rescue Error
+        nil
+      end
+
+      def stats
+        stats = conn.stats
+        {
+          url: conn.url,
+          connected: conn.connected?,
+          in_flight: stats[:in_flight],
+          calls: calls,
+          errors: errors,
+          latency_avg: stats[:latency_avg]
+        }
+      end
+    end
+
+    #
+    # @return [Array<LWTarantool::Connection>] pool connections.
+    #
+    attr_reader :connections
+
+    #
+    # Create a pool of connections.
+    #
+    # Members which fail to connect are reconnected in background.
+    #
+    # @param [String, Array<String>] url tarantool address or addresses.
+    # @param [Integer] size count of connections per address.
+    # @param [Numeric] reconnect_interval delay between reconnect attempts.
+    # @param [Hash] options other {LWTarantool::Connection#initialize} options.
+    #
+    # @example
+    #   pool = LWTarantool::Pool.new(url: %w[10.0.0.1:3301 10.0.0.2:3301], size: 4)
+    #   pool.call('box.info', []).result
+    #
+    def initialize(url:, size: 1, reconnect_interval: 1, **options)
+      urls = Array(url)
+      raise ArgumentError, 'url must not be empty' if urls.empty?
+      raise ArgumentError, 'size must be positive' unless size.positive?
+
+      @members = urls.flat_map do |u|
+        Array.new(size) { Member.new(Connection.new(options.merge(url: u, connect: false))) }
+      end
+      @connections = @members.map(&:conn).freeze
+      @members.each(&:connect)
+      @offset = 0
+
+      @reconnect_interval = reconnect_interval
+      @reconnector = Thread.new { reconnect_loop }
+    end
+
+    #
+    # Call a function in tarantool using the least loaded connection.
+    #
+    # Call is retried on other members if connection fails.
+    #
+    # @param [String] func the tarantool function for call.
+    # @param [Array] args the tarantool function arguments.
+    # @param [Hash] options {LWTarantool::Connection#call} options.
+    #
+    # @return [LWTarantool::Request] a new request instance.
+    #
+    # @raise (see LWTarantool::Connection#call)
+    #
+    def call(func, args, **options)
+      tried = []
+
+      begin
+        member = pick(tried)
+        tried << member
+        member.call(func, args, **options)
+      rescue *CONNECTION_ERRORS
+        retry if tried.size < @members.size
+        raise
+      end
+    end
+
+    #
+    # Per-member statistics.
+    #
+    # @return [Array<Hash>] url, connected, in_flight, calls, errors and
+    #   latency_avg of every member.
+    #
+    def stats
+      @members.map(&:stats)
+    end
+
+    #
+    # Stop background reconnects and close all connections.
+    #
+    def close
+      @reconnector.kill
+      @reconnector.join
+      connections.each(&:disconnect)
+    end
+
+    private
+
+    def pick(tried)
+      candidates = @members - tried
+      connected = candidates.select { |m| m.conn.connected? }
+      candidates = connected unless connected.empty?
+
+      # rotate candidates, so ties are spread between members
+      @offset = (@offset + 1) % candidates.size
+      candidates.rotate(@offset).min_by { |m| m.conn.in_flight }
+    end
+
+    def reconnect_loop
+      loop do
+        sleep @reconnect_interval
+        @members.each { |m| m.connect unless m.conn.connected? }
+      end
+    end
+  end
+end
@@ -0,0 +1,69 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  #
+  # Frozen reply detached from request with {LWTarantool::Request#detach}.
+  #
+  # Reply owns its buffer and is shareable between Ractors, it's decoded
+  # lazily in the Ractor that reads it.
+  #
+  # @example
+  #   decoder = Ractor.new { Ractor.receive.result.size }
+  #   decoder.send(conn.call('get_report', [id]).detach)
+  #   decoder.take
+  #
+  class Reply
+    #
+    # Decode response data.
+    #
+    # @param [Boolean] first decode only the first tuple of response.
+    # @param [Range] range decode only tuples of the range.
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @return [Array] response data if request was successfull processed.
+    # @return [Object] the first tuple if first is true.
+    # @return [nil] nil if request failed.
+    #
+    def result(first: false, range: nil, symbolize_keys: false, freeze: false)
+      _result(first, range, symbolize_keys, freeze)
+    end
+
+    #
+    # Decode response tuples one by one.
+    #
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @yieldparam [Object] tuple a decoded tuple.
+    #
+    # @return [LWTarantool::Reply] self, or an Enumerator without a block.
+    #
+    def each_tuple(symbolize_keys: false, freeze: false, &block)
+      return enum_for(:each_tuple, symbolize_keys: symbolize_keys, freeze: freeze) unless block
+
+      _each_tuple(symbolize_keys, freeze, &block)
+      self
+    end
+
+    #
+    # Number of response tuples without decoding them.
+    #
+    # @return [Integer] number of tuples.
+    # @return [nil] nil if request failed.
+    #
+    def size
+      _size
+    end
+
+    #
+    # Tarantool error message.
+    #
+    # @return [String] Tarantool error message if request failed.
+    # @return [nil] nil if request success.
+    #
+    def error
+      _error
+    end
+  end
+end
@@ -1,7 +1,5 @@
 # frozen_string_literal: true
 
-require 'msgpack'
-
 module LWTarantool
   # Class for work with Tarantool requests
   class Request
@@ -12,33 +10,166 @@ module LWTarantool
     #
     attr_reader :conn
 
+    #
+    # Deadline of request on monotonic clock.
+    #
+    # @return [Float, nil] deadline or nil if request has no timeout.
+    #
+    attr_reader :deadline
+
+    # @api private
+    attr_writer :deadline
+
+    # @api private
+    attr_accessor :statement
+
+    #
+    # Called function, set with function_metrics or on_reply connection option.
+    #
+    # @return [String, nil] function name.
+    #
+    attr_accessor :function
+
     #
     # Wait for request be processed by Tarantool.
     #
+    # Request fails with "Request timed out" error if it isn't processed
+    # in timeout seconds or before its deadline. A late response is dropped.
+    #
+    # @param [Numeric] timeout seconds to wait for.
+    #
     # @example
     #   req.wait
+    #   req.wait(0.5)
     #
     # @raise [LWTarantool::SyncError] incorrect tarantool response.
     # @raise [LWTarantool::SystemError] connection was closed.
     # @raise [LWTarantool::UnknownError] unknown error.
     #
-    def wait
-      conn.read until ready?
+    def wait(timeout = nil)
+      conn.wait_for(self, timeout)
     end
 
     #
     # Wait for request processing and return tarantool reponse data.
     #
+    # Response is decoded natively straight from the reply buffer.
+    #
+    # @param [Boolean] first decode only the first tuple of response.
+    # @param [Range] range decode only tuples of the range.
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
     # @example
     #   req.result
+    #   req.result(first: true)
+    #   req.result(range: 10...20, symbolize_keys: true)
     #
     # @return [Array] response data if request was successfull processed.
+    # @return [Object] the first tuple if first is true.
     # @return [nil] nil if request failed.
     #
-    def result
+    def result(first: false, range: nil, symbolize_keys: false, freeze: false)
       wait unless ready?
-      res = _result
-      MessagePack.unpack(res) unless res.nil?
+      _result(first, range, symbolize_keys, freeze)
+    end
+
+    #
+    # Wait for request processing and decode response tuples one by one.
+    #
+    # Unlike {#result} the response isn't decoded into a single Array,
+    # so memory used by decoded tuples is bounded by the block.
+    #
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @example
+    #   req.each_tuple { |tuple| process(tuple) }
+    #   req.each_tuple.with_index { |tuple, i| process(i, tuple) }
+    #
+    # @yieldparam [Object] tuple a decoded tuple.
+    #
+    # @return [LWTarantool::Request] self, or an Enumerator without a block.
+    #
+    def each_tuple(symbolize_keys: false, freeze: false, &block)
+      return enum_for(:each_tuple, symbolize_keys: symbolize_keys, freeze: freeze) unless block
+
+      wait unless ready?
+      _each_tuple(symbolize_keys, freeze, &block)
+      self
+    end
+
+    #
+    # Wait for request processing and return number of response tuples
+    # without decoding them.
+    #
+    # @return [Integer] number of tuples.
+    # @return [nil] nil if request failed.
+    #
+    def size
+      wait unless ready?
+      _size
+    end
+
+    #
+    # Wait for SQL request processing and return result column description.
+    #
+    # Description is cached per statement, a repeated query reuses it while
+    # the result columns don't change.
+    #
+    # @example
+    #   conn.execute('SELECT id, name FROM users', []).metadata
+    #   # => [{ name: 'ID', type: 'integer' }, { name: 'NAME', type: 'string' }]
+    #
+    # @return [Array<Hash>] columns with :name and :type.
+    # @return [nil] nil if request failed or has no result set.
+    #
+    def metadata
+      wait unless ready?
+      @metadata ||= decode_metadata
+    end
+
+    #
+    # Wait for SQL request processing and return changes info.
+    #
+    # @example
+    #   conn.execute('INSERT INTO users (name) VALUES (?)', ['x']).sql_info
+    #   # => { row_count: 1, autoincrement_ids: [1] }
+    #
+    # @return [Hash] :row_count and :autoincrement_ids.
+    # @return [nil] nil if request failed or isn't a data change.
+    #
+    def sql_info
+      wait unless ready?
+      info = _sql_info
+      info && { row_count: info[0], autoincrement_ids: info[1] || [] }
+    end
+
+    #
+    # Wait for SQL request processing and return result set by columns.
+    #
+    # Rows are decoded straight into per-column arrays, without an object
+    # per row.
+    #
+    # @param [Boolean] symbolize_keys use symbols as column names and hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @example
+    #   conn.execute('SELECT id, name FROM users', []).columns
+    #   # => { 'ID' => [1, 2], 'NAME' => ['a', 'b'] }
+    #
+    # @return [Hash<String, Array>] values of every column by its name.
+    # @return [nil] nil if request failed or has no result set.
+    #
+    def columns(symbolize_keys: false, freeze: false)
+      meta = metadata
+      return unless meta
+
+      data = _columns(meta.size, symbolize_keys, freeze)
+      return unless data
+
+      names = meta.map { |col| symbolize_keys ? col[:name].to_sym : col[:name] }
+      names.zip(data).to_h
     end
 
     #
@@ -54,5 +185,75 @@ module LWTarantool
       wait unless ready?
       _error
     end
+
+    #
+    # Wait for request processing and move its reply into a frozen
+    # {LWTarantool::Reply}.
+    #
+    # Reply takes over the reply buffer without copying and is shareable,
+    # so it can be sent to another Ractor and decoded there. Request is
+    # released, a request shared by coalesced calls keeps its reply and
+    # gives a copy.
+    #
+    # @example
+    #   worker.send(conn.call('get_report', [id]).detach)
+    #
+    # @return [LWTarantool::Reply] detached reply.
+    #
+    # @raise [LWTarantool::Error] reply was released.
+    #
+    def detach
+      wait unless ready?
+      _detach
+    end
+
+    #
+    # Mark request as shared by coalesced calls, so {#release} does nothing.
+    #
+    # @api private
+    #
+    def share
+      _share
+    end
+
+    #
+    # Size of reply buffer in bytes, 0 if request isn't processed yet.
+    #
+    # @api private
+    #
+    def bytesize
+      _bytesize
+    end
+
+    #
+    # Sleep on mutex until {#wakeup} called or timeout is reached.
+    #
+    # @api private
+    #
+    def sleep(mutex, timeout = nil)
+      (@cond ||= ConditionVariable.new).wait(mutex, timeout)
+    end
+
+    #
+    # Wake up threads sleeping in {#sleep}.
+    #
+    # @api private
+    #
+    def wakeup
+      @cond&.broadcast
+    end
+
+    private
+
+    def decode_metadata
+      raw, columns = statement&.cache
+      return columns if raw && _metadata_match?(raw)
+
+      meta = _metadata
+      return unless meta
+
+      columns = meta.map { |col| { name: col[0], type: col[1] }.freeze }.freeze
+      statement ? statement.cache!(_metadata_raw, columns) : columns
+    end
   end
 end
@@ -0,0 +1,17 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Reader of Tarantool snapshot files.
+  #
+  # A snapshot has the same format as an xlog, every its row is an insert
+  # of a tuple, so {#each_tuple} yields all tuples of a space.
+  #
+  # @example
+  #   LWTarantool::Snapshot.open('00000000000000000042.snap') do |snap|
+  #     snap.each_tuple(space: 512) { |tuple| cache[tuple[0]] = tuple }
+  #   end
+  class Snapshot < Xlog
+    # File type in meta block.
+    FILE_TYPE = 'SNAP'
+  end
+end
@@ -0,0 +1,36 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Cached SQL statement of {LWTarantool::Connection#execute}.
+  #
+  # Keeps column description of the last result, so results of a repeated
+  # query reuse it instead of decoding it again while it doesn't change.
+  class Statement
+    # @return [String] SQL text.
+    attr_reader :sql
+
+    # @return [Array(String, Array<Hash>), nil] raw and decoded metadata
+    #   of the last result.
+    # @api private
+    attr_reader :cache
+
+    # @api private
+    def initialize(sql)
+      @sql = sql
+      @cache = nil
+    end
+
+    #
+    # Cache column description of a result.
+    #
+    # @return [Array<Hash>] columns.
+    #
+    # @api private
+    #
+    def cache!(raw, columns)
+      # a single assignment, so readers never see raw and columns of different results
+      @cache = [raw, columns].freeze
+      columns
+    end
+  end
+end
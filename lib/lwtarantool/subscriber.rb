@@ -0,0 +1,159 @@
+# frozen_string_literal: true
+
+require 'securerandom'
+
+module LWTarantool
+  # Replication stream subscriber.
+  #
+  # Subscriber connects to Tarantool as an anonymous replica and streams
+  # data changes, so caches can be invalidated by push instead of polling.
+  # Rows are waited for without GVL, other threads keep running.
+  #
+  # Stream position is a vclock (replica id => lsn), save {#vclock} and pass
+  # it to a new subscriber to resume after restart.
+  #
+  # Once subscribed, the connection carries the stream only and can't be
+  # used for other requests.
+  #
+  # @example
+  #   sub = LWTarantool::Subscriber.new(url: '127.0.0.1:3301', space: 512, vclock: saved_vclock)
+  #   sub.each { |row| cache.delete(row[:key] || row[:tuple].first) }
+  class Subscriber < Connection
+    # Seconds between acknowledgements sent to master.
+    ACK_INTERVAL = 1
+
+    # @return [String] instance uuid of the subscriber.
+    attr_reader :uuid
+
+    #
+    # Create a subscriber.
+    #
+    # @param [Hash, Integer, nil] vclock position to stream from, an Integer
+    #   is lsn of replica 1, nil means the current server vclock, i.e. only
+    #   new changes are streamed.
+    # @param [Integer, Array<Integer>] space stream rows of these spaces only.
+    # @param [String] uuid instance uuid of the subscriber.
+    # @param [String] replicaset_uuid replicaset uuid, asked from server by default.
+    # @param [Numeric] ack_interval seconds between acknowledgements.
+    # @param [Hash] args other {LWTarantool::Connection#initialize} options.
+    #
+    # @raise (see LWTarantool::Connection#initialize)
+    #
+    def initialize(vclock: nil, space: nil, uuid: SecureRandom.uuid, replicaset_uuid: nil,
+                   ack_interval: ACK_INTERVAL, **args)
+      super(args)
+
+      @space = space
+      @uuid = uuid
+      @replicaset_uuid = replicaset_uuid
+      @ack_interval = ack_interval
+      @vclock = vclock.is_a?(Integer) ? { 1 => vclock } : vclock&.dup
+      @subscribed = false
+      @stopped = false
+    end
+
+    #
+    # Stream position: lsn of the last received row of every replica.
+    #
+    # @return [Hash<Integer, Integer>] a copy of the current vclock.
+    #
+    def vclock
+      @vclock&.dup
+    end
+
+    #
+    # Subscribe and yield data changes until {#stop}.
+    #
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @yieldparam [Hash] row a data change: :type (:insert, :replace,
+    #   :update, :delete, :upsert), :lsn, :replica_id, :timestamp, :space
+    #   and request fields :index, :key, :tuple and :ops.
+    #
+    # @return [LWTarantool::Subscriber] self, or an Enumerator without a block.
+    #
+    # @raise [LWTarantool::Error] server refused subscription.
+    # @raise [LWTarantool::SystemError] connection failed.
+    #
+    def each(symbolize_keys: false, freeze: false)
+      return enum_for(:each, symbolize_keys: symbolize_keys, freeze: freeze) unless block_given?
+
+      subscribe unless @subscribed
+      acked_at = clock
+
+      until @stopped
+        left = acked_at + @ack_interval - clock
+        row = left.positive? ? _next_row(left, @vclock, @space, symbolize_keys, freeze) : nil
+
+        if clock - acked_at >= @ack_interval
+          _ack(@vclock)
+          acked_at = clock
+        end
+
+        yield row if row.is_a?(Hash)
+      end
+
+      self
+    rescue SystemError
+      raise unless @stopped
+
+      self
+    end
+
+    #
+    # Stream data changes in a background thread.
+    #
+    # @param [#<<] queue rows are pushed to it, if given.
+    # @param [Hash] options {#each} options.
+    #
+    # @yieldparam [Hash] row a data change, if no queue given.
+    #
+    # @example
+    #   queue = Queue.new
+    #   sub.start(queue)
+    #   sub.start { |row| cache.delete(row[:key]) }
+    #
+    # @return [Thread] the streaming thread.
+    #
+    def start(queue = nil, **options, &callback)
+      raise ArgumentError, 'queue or block is required' unless queue || callback
+
+      callback ||= ->(row) { queue << row }
+      @thread = Thread.new { each(**options, &callback) }
+    end
+
+    #
+    # Stop streaming and close connection.
+    #
+    # The streaming thread is joined if it was started by {#start}.
+    #
+    def stop
+      @stopped = true
+      disconnect
+      @thread&.join unless @thread == Thread.current
+    end
+
+    private
+
+    def subscribe
+      info = call('box.info', []).result&.first if @vclock.nil? || @replicaset_uuid.nil?
+      raise Error, 'box.info is not available' if info.nil? && (@vclock.nil? || @replicaset_uuid.nil?)
+
+      @vclock ||= server_vclock(info['vclock'])
+      @replicaset_uuid ||= (info['replicaset'] || info['cluster'])['uuid']
+
+      mutex.synchronize do
+        _connect unless connected?
+        _subscribe(@uuid, @replicaset_uuid, @vclock, true)
+      end
+      @subscribed = true
+    end
+
+    # Lua encodes vclock without replica 0 as an array.
+    def server_vclock(vclock)
+      vclock = vclock.each_with_index.to_h { |lsn, i| [i + 1, lsn] } if vclock.is_a?(Array)
+      vclock.reject { |id, _| id.zero? }
+    end
+  end
+end
@@ -0,0 +1,191 @@
+# frozen_string_literal: true
+
+module LWTarantool
+  # Reader of Tarantool xlog files (format 0.13).
+  #
+  # The file is mapped into memory and rows are decoded lazily one by one,
+  # so reading doesn't load a server or materialize the whole file.
+  # Zstd compressed transactions are supported when the gem is built with
+  # libzstd.
+  class Xlog
+    # File type in meta block.
+    FILE_TYPE = 'XLOG'
+
+    # Supported format version.
+    VERSION = '0.13'
+
+    # @return [String] file path.
+    attr_reader :path
+
+    # @return [Hash<String, String>] meta block (type, version, Instance, VClock and so on).
+    attr_reader :meta
+
+    #
+    # Open a file.
+    #
+    # @param [String] path the file path.
+    #
+    # @yieldparam [LWTarantool::Xlog] the open file, it is closed after the block.
+    #
+    # @example
+    #   LWTarantool::Xlog.open('00000000000000000042.xlog') do |xlog|
+    #     xlog.each_row(space: 512) { |row| p row }
+    #   end
+    #
+    # @return [LWTarantool::Xlog] the open file without a block, otherwise
+    #   the block result.
+    #
+    # @raise [LWTarantool::XlogError] the file has wrong type or version.
+    # @raise [SystemCallError] the file can't be open.
+    #
+    def self.open(path)
+      file = new(path)
+      return file unless block_given?
+
+      begin
+        yield file
+      ensure
+        file.close
+      end
+    end
+
+    #
+    # Iterate over rows of all xlog files of a directory in LSN order.
+    #
+    # With threads more than 1 the following files are prepared (scanned and
+    # decompressed without GVL) in background threads while the current one
+    # is decoded.
+    #
+    # @param [String] dir the directory.
+    # @param [Integer, Array<Integer>] space yield rows of these spaces only.
+    # @param [Integer] threads number of threads preparing files.
+    #
+    # @yieldparam [Hash] row a decoded row (see #each_row).
+    #
+    # @example
+    #   LWTarantool::Xlog.scan('/var/lib/tarantool', space: 512, threads: 4) { |row| p row }
+    #
+    # @return [Enumerator] rows enumerator if no block is given.
+    #
+    def self.scan(dir, space: nil, threads: 1, symbolize_keys: false, freeze: false, &block)
+      return enum_for(:scan, dir, space: space, threads: threads, symbolize_keys: symbolize_keys, freeze: freeze) unless block
+
+      paths = Dir.glob(File.join(dir, '*.xlog')).sort
+      options = { space: space, symbolize_keys: symbolize_keys, freeze: freeze }
+
+      each_prepared(paths, threads) do |xlog|
+        xlog.each_row(**options, &block)
+      end
+    end
+
+    #
+    # Open files preparing them in threads and yield them in order.
+    #
+    # At most threads files are prepared ahead, a token is taken before
+    # a file, so tokens are always held by the first unprocessed files.
+    #
+    # @api private
+    #
+    def self.each_prepared(paths, threads)
+      return paths.each { |path| open(path) { |xlog| yield xlog } } if threads <= 1
+
+      jobs = Queue.new
+      paths.each_index { |i| jobs << i }
+      tokens = SizedQueue.new(threads)
+      results = paths.map { Queue.new }
+
+      workers = Array.new([threads, paths.size].min) do
+        Thread.new do
+          loop do
+            tokens << true
+            i = jobs.pop(true)
+            results[i] << begin
+              new(paths[i]).prepare
+            rescue StandardError => e
+              e
+            end
+          end
+        rescue ThreadError
+          # no more files
+        end
+      end
+
+      results.each do |result|
+        xlog = result.pop
+        raise xlog if xlog.is_a?(Exception)
+
+        begin
+          yield xlog
+        ensure
+          xlog.close
+          tokens.pop
+        end
+      end
+    ensure
+      workers&.each(&:kill)&.each(&:join)
+      results&.each { |result| result.pop(true).close rescue nil until result.empty? }
+    end
+
+    #
+    # @param (see .open)
+    #
+    def initialize(path)
+      @path = path
+      @meta = _open(path)
+      check_meta!
+    end
+
+    #
+    # Yield tuples of inserted and replaced rows.
+    #
+    # Space id is checked before a tuple is decoded, tuples of other spaces
+    # are skipped cheaply.
+    #
+    # @param [Integer, Array<Integer>] space yield tuples of these spaces only.
+    # @param [Boolean] symbolize_keys use symbols as hash keys.
+    # @param [Boolean] freeze freeze strings and deduplicate them when possible.
+    #
+    # @yieldparam [Array] tuple a decoded tuple.
+    #
+    # @return [LWTarantool::Xlog] self, or an Enumerator without a block.
+    #
+    # @raise [LWTarantool::XlogError] the file is corrupted or closed.
+    #
+    def each_tuple(space: nil, symbolize_keys: false, freeze: false, &block)
+      return enum_for(:each_tuple, space: space, symbolize_keys: symbolize_keys, freeze: freeze) unless block
+
+      _each(space, false, symbolize_keys, freeze, &block)
+    end
+
+    #
+    # Yield rows as hashes.
+    #
+    # A row has :type (:insert, :replace, :update, :delete, :upsert, :nop or
+    # a number of other request), :lsn, :replica_id, :timestamp, and the
+    # request fields it has: :space, :index, :key, :tuple and :ops.
+    #
+    # @param (see #each_tuple)
+    #
+    # @yieldparam [Hash] row a decoded row.
+    #
+    # @return [LWTarantool::Xlog] self, or an Enumerator without a block.
+    #
+    # @raise (see #each_tuple)
+    #
+    def each_row(space: nil, symbolize_keys: false, freeze: false, &block)
+      return enum_for(:each_row, space: space, symbolize_keys: symbolize_keys, freeze: freeze) unless block
+
+      _each(space, true, symbolize_keys, freeze, &block)
+    end
+
+    private
+
+    def check_meta!
+      raise XlogError, "#{path} is not a #{self.class::FILE_TYPE} file" unless meta['type'] == self.class::FILE_TYPE
+      raise XlogError, "#{path} has unsupported version #{meta['version']}" unless meta['version'] == VERSION
+    rescue StandardError
+      close
+      raise
+    end
+  end
+end
@@ -1,6 +1,7 @@
 # frozen_string_literal: true
 
 require_relative 'spec_helper'
+require 'io/nonblock'
 
 describe 'LWTarantool::Connection' do
   before(:each) do
@@ -9,6 +10,8 @@ describe 'LWTarantool::Connection' do
       function test1() return {1, 2, 3}; end
       function test2() return 1, 2, 3; end
       function test3(p1, p2) return p1, p2; end
+      box.schema.space.create("test", {id = 512}):create_index("pk")
+      function create_space(name) box.schema.space.create(name):create_index("pk"); end
     '
   end
 
@@ -47,6 +50,12 @@ describe 'LWTarantool::Connection' do
       expect { LWTarantool.new(url: '127.0.0.1:3302') }.to raise_error(LWTarantool::SystemError, /Connection refused/)
     end
 
+    it 'fails the first read when login fails' do
+      conn = LWTarantool.new(url: 'nobody:secret@127.0.0.1:3301')
+      expect { conn.call('test1', []).wait }.to raise_error(LWTarantool::LoginError, /nobody/)
+      expect(conn.connected?).to be false
+    end
+
     context 'timeout' do
       # FIXME: 8.8.8.8 is well-known IP address with blackholed ports, but there are no any garantees
 
@@ -85,6 +94,134 @@ describe 'LWTarantool::Connection' do
       conn = LWTarantool.new(url: '127.0.0.1:3301')
       expect(conn.instance_eval { @mutex }).to be_a Mutex
     end
+
+    it 'use blocking mode by default' do
+      expect(conn.nonblock?).to be false
+    end
+
+    it 'accept nonblock option' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', nonblock: true)
+      expect(conn.nonblock?).to be true
+    end
+
+    it 'accept timeout option' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', timeout: 0.1)
+      expect(conn.timeout).to eq 0.1
+      expect(conn.call('fiber.sleep', [0.5]).error).to match(/timed out/)
+    end
+
+    it 'raise on invalid timeout' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', timeout: '1') }.to raise_error(ArgumentError, /timeout/)
+    end
+
+    it 'use msgpack encoder by default' do
+      expect(conn.encoder).to eq :msgpack
+    end
+
+    it 'accept encoder option' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', encoder: :native)
+      expect(conn.encoder).to eq :native
+    end
+
+    it 'raise on unknown encoder' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', encoder: :json) }.to raise_error(ArgumentError, /encoder/)
+    end
+  end
+
+  context 'native encoder' do
+    let(:conn) do
+      LWTarantool.new(url: '127.0.0.1:3301', encoder: :native)
+    end
+
+    it 'encode args' do
+      args = [nil, true, false, 0, -1, 2**40, -2**40, 2**64 - 1, 1.5, 'str', :sym, [1, [2]], { 'a' => 1 }]
+      expected = [nil, true, false, 0, -1, 2**40, -2**40, 2**64 - 1, 1.5, 'str', 'sym', [1, [2]], { 'a' => 1 }]
+      expect(conn.call('test3', [args, 'x' * 10_000]).result).to eq [expected, 'x' * 10_000]
+    end
+
+    it 'raise on unsupported objects' do
+      expect { conn.call('test3', [Object.new]) }.to raise_error(TypeError)
+      expect { conn.call('test3', [2**64]) }.to raise_error(RangeError)
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+    end
+
+    it 'raise if args is not an Array' do
+      expect { conn.call('test3', 'aaa') }.to raise_error(ArgumentError)
+    end
+
+    it 'raise TooLargeRequestError if request > send buffer' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', send_buf_size: 20_021, encoder: :native)
+      expect { conn.call('test', ['x' * 19_999]) }.not_to raise_error
+      expect { conn.call('test', ['x' * 20_000]) }.to raise_error(LWTarantool::TooLargeRequestError)
+    end
+  end
+
+  context 'nonblock mode' do
+    let(:conn) do
+      LWTarantool.new(url: '127.0.0.1:3301', nonblock: true)
+    end
+
+    it 'use non-blocking socket' do
+      expect(conn.io.nonblock?).to be true
+    end
+
+    it 'process requests' do
+      reqs = [conn.call('test1', []), conn.call('test3', %w[aaa bbb])]
+      expect(reqs.map(&:result)).to eq [[[1, 2, 3]], %w[aaa bbb]]
+    end
+
+    it 'keep non-blocking socket after reconnect' do
+      conn.disconnect
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      expect(conn.io.nonblock?).to be true
+    end
+
+    it 'not lock connection while waiting for response' do
+      req1 = conn.call('fiber.sleep', [0.5])
+      thread = Thread.new { req1.wait }
+      sleep 0.1
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      thread.join
+      expect(req1.ready?).to be true
+    end
+  end
+
+  context 'multiplex mode' do
+    let(:conn) do
+      LWTarantool.new(url: '127.0.0.1:3301', multiplex: true)
+    end
+
+    it 'accept multiplex option' do
+      expect(conn.multiplex?).to be true
+    end
+
+    it 'process requests from many threads concurrently' do
+      time = Time.now
+      threads = Array.new(10) do |i|
+        Thread.new do
+          conn.call('fiber.sleep', [0.5]).wait
+          conn.call('test3', [i, 'x']).result
+        end
+      end
+      expect(threads.map(&:value)).to eq Array.new(10) { |i| [i, 'x'] }
+      expect(Time.now - time).to be < 1
+    end
+
+    it 'wake up waiters on disconnect' do
+      req = conn.call('fiber.sleep', [60])
+      thread = Thread.new { req.error }
+      sleep 0.1
+      conn.disconnect
+      expect(thread.value).to match(/canceled/)
+    end
+
+    it 'time out requests independently' do
+      slow = Thread.new { conn.call('fiber.sleep', [0.5], timeout: 0.1).error }
+      fast = Thread.new { conn.call('fiber.sleep', [0.2]).error }
+      expect(slow.value).to match(/timed out/)
+      expect(fast.value).to be_nil
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+    end
   end
 
   context '#call' do
@@ -143,6 +280,250 @@ describe 'LWTarantool::Connection' do
     end
   end
 
+  context '#call_many' do
+    it 'returns Requests in the same order' do
+      reqs = conn.call_many([['test3', [1, 'a']], ['test3', [2, 'b']], ['test3', [3, 'c']]])
+      expect(reqs.size).to eq 3
+      expect(reqs).to all(be_a(LWTarantool::Request))
+      expect(reqs.map(&:result)).to eq [[1, 'a'], [2, 'b'], [3, 'c']]
+    end
+
+    it 'sends requests with a single flush' do
+      expect(conn).to receive(:_call_many).once.and_call_original
+      expect(conn).not_to receive(:_call)
+      conn.call_many([['test1', []], ['test2', []]]).each(&:wait)
+    end
+
+    it 'accepts empty list' do
+      expect(conn.call_many([])).to eq []
+    end
+
+    it 'sends encoded requests if one of calls is invalid' do
+      expect { conn.call_many([['test1', []], [:test1, []]]) }.to raise_error(ArgumentError)
+      expect(conn.read.result).to eq [[1, 2, 3]]
+    end
+
+    it 'reconnect if connection lost' do
+      conn
+      stop_tarantool
+      start_tarantool
+      expect { conn.call_many([['test1', []]]) }.not_to raise_exception
+      expect { conn.call_many([['test1', []]]) }.not_to raise_exception
+    end
+  end
+
+  context '#select' do
+    before(:each) do
+      [1, 2, 3].each { |i| conn.insert(512, [i, "t#{i}"]).wait }
+    end
+
+    it 'selects by key' do
+      expect(conn.select(512, [2]).result).to eq [[2, 't2']]
+      expect(conn.select(512, 3).result).to eq [[3, 't3']]
+      expect(conn.select(512, 4).result).to eq []
+    end
+
+    it 'selects with iterator, limit and offset' do
+      expect(conn.select(512).result).to eq [[1, 't1'], [2, 't2'], [3, 't3']]
+      expect(conn.select(512, 2, iterator: :ge).result).to eq [[2, 't2'], [3, 't3']]
+      expect(conn.select(512, 3, iterator: :lt, limit: 1).result).to eq [[2, 't2']]
+      expect(conn.select(512, [], iterator: :all, offset: 1, limit: 1).result).to eq [[2, 't2']]
+      expect(conn.select(512, 1, iterator: 6).result).to eq [[2, 't2'], [3, 't3']]
+    end
+
+    it 'raises ArgumentError on invalid arguments' do
+      expect { conn.select(512, 1, iterator: :unknown) }.to raise_error(ArgumentError)
+      expect { conn.select(-1, 1) }.to raise_error(ArgumentError)
+      expect { conn.select(512, 1, limit: -1) }.to raise_error(ArgumentError)
+    end
+
+    it 'fails request for unknown space' do
+      expect(conn.select(999, 1).error).to match(/Space '999' does not exist/)
+    end
+
+    it 'works with native encoder' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', encoder: :native)
+      expect(conn.select(512, 1).result).to eq [[1, 't1']]
+    end
+  end
+
+  context '#select_each' do
+    before(:each) do
+      Array.new(25) { |i| conn.insert(512, [i, "t#{i}"]) }.each(&:wait)
+    end
+
+    it 'yields all tuples by pages' do
+      tuples = []
+      conn.select_each(512, [], iterator: :all, page_size: 10) { |t| tuples << t }
+      expect(tuples).to eq Array.new(25) { |i| [i, "t#{i}"] }
+    end
+
+    it 'returns Pager without a block' do
+      pager = conn.select_each(:test, 20, iterator: :ge, page_size: 5)
+      expect(pager).to be_a(LWTarantool::Pager)
+      expect(pager.map(&:first)).to eq [20, 21, 22, 23, 24]
+    end
+  end
+
+  context '#pages' do
+    it 'fetches pages with offset and limit' do
+      pages = []
+      pager = conn.pages(page_size: 2) do |offset, limit|
+        pages << offset
+        conn.call('test3', [offset, limit]) if offset < 4
+      end
+      expect(pager.to_a).to eq [0, 2, 2, 2]
+      expect(pages).to eq [0, 2, 4]
+    end
+
+    it 'raises if page request failed' do
+      expect { conn.pages { conn.select(999) }.to_a }.to raise_error(LWTarantool::Error, /Space '999'/)
+    end
+
+    it 'requires positive page size' do
+      expect { conn.pages(page_size: 0) { nil } }.to raise_error(ArgumentError)
+    end
+  end
+
+  context 'schema' do
+    it 'resolves space and index names' do
+      expect(conn.space_id('test')).to eq 512
+      expect(conn.space_id(:test)).to eq 512
+      expect(conn.space_id(512)).to eq 512
+      expect(conn.index_id(:test, :pk)).to eq 0
+      conn.insert(:test, [1, 'a']).wait
+      expect(conn.select('test', 1, index: 'pk').result).to eq [[1, 'a']]
+    end
+
+    it 'raises SchemaError for unknown names' do
+      expect { conn.space_id(:unknown) }.to raise_error(LWTarantool::SchemaError, /Space 'unknown'/)
+      expect { conn.index_id(:test, :unknown) }.to raise_error(LWTarantool::SchemaError, /No index 'unknown'/)
+    end
+
+    it 'loads schema once' do
+      expect(conn).to receive(:_load_schema).once.and_call_original
+      3.times { conn.select(:test, 1).wait }
+    end
+
+    it 'reloads schema when it is changed' do
+      conn.select(:test, 1).wait
+      schema_id = conn.stats[:schema_id]
+      expect(schema_id).to be > 0
+
+      conn.call('create_space', ['other']).wait
+      expect(conn.select(:other, 1).result).to eq []
+      expect(conn.stats[:schema_id]).to be > schema_id
+    end
+
+    it 'reloads schema after reconnect' do
+      conn.space_id(:test)
+      conn.disconnect
+      conn.connect
+      expect(conn.stats[:schema_id]).to eq 0
+      expect(conn.space_id(:test)).to eq 512
+    end
+  end
+
+  context 'data manipulation' do
+    it 'inserts and replaces tuples' do
+      expect(conn.insert(512, [1, 'a']).result).to eq [[1, 'a']]
+      expect(conn.insert(512, [1, 'b']).error).to match(/Duplicate key/)
+      expect(conn.replace(512, [1, 'c']).result).to eq [[1, 'c']]
+      expect(conn.select(512, 1).result).to eq [[1, 'c']]
+    end
+
+    it 'updates tuples' do
+      conn.insert(512, [1, 10]).wait
+      expect(conn.update(512, 1, [['+', 2, 5]]).result).to eq [[1, 15]]
+      expect(conn.update(512, [2], [['+', 2, 5]]).result).to eq []
+    end
+
+    it 'upserts tuples' do
+      expect(conn.upsert(512, [1, 10], [['+', 2, 1]]).result).to eq []
+      expect(conn.upsert(512, [1, 10], [['+', 2, 1]]).result).to eq []
+      expect(conn.select(512, 1).result).to eq [[1, 11]]
+    end
+
+    it 'deletes tuples' do
+      conn.insert(512, [1, 'a']).wait
+      expect(conn.delete(512, 1).result).to eq [[1, 'a']]
+      expect(conn.delete(512, 1).result).to eq []
+    end
+
+    it 'reconnect if connection lost' do
+      conn
+      stop_tarantool
+      start_tarantool 'box.schema.space.create("test", {id = 512}):create_index("pk")'
+      expect { conn.insert(512, [1, 'a']) }.not_to raise_exception
+      expect { conn.insert(512, [2, 'b']).wait }.not_to raise_exception
+    end
+  end
+
+  context '#execute' do
+    before(:each) do
+      conn.execute('CREATE TABLE t (id INTEGER PRIMARY KEY, name STRING)').wait
+    end
+
+    it 'returns rows with metadata' do
+      conn.execute("INSERT INTO t VALUES (1, 'a')").wait
+      req = conn.execute('SELECT id, name FROM t')
+      expect(req.result).to eq [[1, 'a']]
+      expect(req.metadata).to eq [{ name: 'ID', type: 'integer' }, { name: 'NAME', type: 'string' }]
+      expect(req.sql_info).to eq nil
+    end
+
+    it 'binds parameters and returns sql info' do
+      req = conn.execute('INSERT INTO t VALUES (?, ?), (?, ?)', [1, 'a', 2, 'b'])
+      expect(req.sql_info).to eq(row_count: 2, autoincrement_ids: [])
+      expect(req.metadata).to eq nil
+    end
+
+    it 'reuses metadata of a statement' do
+      first = conn.execute('SELECT id, name FROM t').metadata
+      expect(conn.execute('SELECT id, name FROM t').metadata).to be(first)
+      expect(conn.execute('SELECT name FROM t').metadata).to eq [{ name: 'NAME', type: 'string' }]
+    end
+
+    it 'keeps recently used statements' do
+      first = conn.instance_eval { statement('SELECT 1') }
+      LWTarantool::Connection::STATEMENT_CACHE_SIZE.times do |i|
+        conn.instance_eval { statement("SELECT #{i + 2}") }
+        conn.instance_eval { statement('SELECT 1') }
+      end
+      expect(conn.instance_eval { statement('SELECT 1') }).to be(first)
+    end
+
+    it 'caches statements of concurrent callers' do
+      threads = Array.new(4) do |t|
+        Thread.new { 300.times { |i| conn.instance_eval { statement("SELECT #{(i * 7 + t) % 300}") } } }
+      end
+      threads.each(&:join)
+
+      expect(conn.instance_eval { statements.size }).to eq LWTarantool::Connection::STATEMENT_CACHE_SIZE
+    end
+
+    it 'fails request on error' do
+      req = conn.execute('SELEKT 1')
+      expect(req.error).to match(/Syntax error/)
+      expect(req.metadata).to eq nil
+    end
+
+    it 'works with native encoder' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', encoder: :native)
+      expect(conn.execute('INSERT INTO t VALUES (?, ?)', [1, 'a']).sql_info[:row_count]).to eq 1
+    end
+  end
+
+  context '#batch' do
+    it 'returns results in the same order' do
+      res = conn.batch do |b|
+        b.call('test3', %w[a b])
+        b.call('test1', [])
+      end
+      expect(res).to eq [%w[a b], [[1, 2, 3]]]
+    end
+  end
+
   context '#read' do
     it 'returns Request' do
       conn.call('test1', [])
@@ -186,6 +567,402 @@ describe 'LWTarantool::Connection' do
       expect(req1.result).to be_nil
       expect(req2.result).to be_nil
     end
+
+    it 'match replies of deep pipeline' do
+      reqs = Array.new(1000) { |i| conn.call('test3', [i, 'x']) }
+      GC.compact if GC.respond_to?(:compact)
+      expect(reqs.reverse.map(&:result)).to eq Array.new(1000) { |i| [999 - i, 'x'] }
+    end
+  end
+
+  context '#read_all' do
+    it 'returns all received requests' do
+      reqs = Array.new(100) { |i| conn.call('test3', [i, 'x']) }
+      read = []
+      read.concat(conn.read_all) until read.size == reqs.size
+
+      expect(read).to eq reqs
+      expect(reqs.map(&:result)).to eq Array.new(100) { |i| [i, 'x'] }
+      expect(conn.stats[:recv_calls]).to be < 100
+    end
+
+    it 'returns empty Array when nothing is in flight' do
+      expect(conn.read_all).to eq []
+    end
+
+    it 'returns empty Array on timeout' do
+      req = conn.call('fiber.sleep', [0.3])
+      expect(conn.read_all(0.05)).to eq []
+      expect(conn.read_all).to eq [req]
+    end
+
+    it 'skips late replies of timed out requests' do
+      conn.call('fiber.sleep', [0.1], timeout: 0.01).wait
+      req = conn.call('test1', [])
+      sleep 0.2
+      expect(conn.read_all).to eq [req]
+    end
+
+    context 'in multiplex mode' do
+      let(:conn) { LWTarantool.new(url: '127.0.0.1:3301', multiplex: true) }
+
+      it 'wakes up waiters of read requests' do
+        req = conn.call('fiber.sleep', [0.1])
+        reader = Thread.new { conn.read_all }
+        sleep 0.05
+        waiter = Thread.new { req.wait }
+
+        expect(reader.value).to eq [req]
+        expect(waiter.join(1)).to be_truthy
+      end
+    end
+  end
+
+  context '#read_nonblock' do
+    it "doesn't wait for replies" do
+      conn.call('fiber.sleep', [0.3])
+      started = Time.now
+      expect(conn.read_nonblock).to eq []
+      expect(Time.now - started).to be < 0.1
+    end
+
+    it 'returns received requests' do
+      reqs = Array.new(3) { conn.call('test1', []) }
+      sleep 0.1
+      expect(conn.read_nonblock).to eq reqs
+    end
+
+    context 'in multiplex mode' do
+      let(:conn) { LWTarantool.new(url: '127.0.0.1:3301', multiplex: true) }
+
+      it 'returns nothing while another thread reads' do
+        req = conn.call('fiber.sleep', [0.3])
+        reader = Thread.new { req.wait }
+        sleep 0.1
+        expect(conn.read_nonblock).to eq []
+        reader.join
+      end
+    end
+  end
+
+  context 'cork mode' do
+    let(:conn) { LWTarantool.new(url: '127.0.0.1:3301', multiplex: true, cork: 10) }
+
+    it 'keeps requests in send buffer' do
+      Array.new(3) { conn.call('test1', []) }
+      expect(conn.stats[:send_calls]).to eq 0
+    end
+
+    it 'sends corked requests together when a reply is waited for' do
+      reqs = Array.new(3) { |i| conn.call('test3', [i, 'x']) }
+
+      expect(reqs.map(&:result)).to eq [[0, 'x'], [1, 'x'], [2, 'x']]
+      expect(conn.stats[:send_calls]).to eq 1
+    end
+
+    it 'sends corked requests after cork window' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', cork: 0.01)
+      conn.call('test1', [])
+      sleep 0.1
+      expect(conn.stats[:send_calls]).to eq 1
+    end
+
+    it 'sends requests taking cork_bytes at once' do
+      conn = LWTarantool.new(url: '127.0.0.1:3301', cork: 10, cork_bytes: 64)
+      conn.call('test1', [])
+      expect(conn.stats[:send_calls]).to eq 0
+      conn.call('test3', ['x' * 64, 'y'])
+      expect(conn.stats[:send_calls]).to eq 1
+    end
+
+    it 'sends requests on #flush' do
+      conn.call('test1', [])
+      conn.flush
+      expect(conn.stats[:send_calls]).to eq 1
+    end
+
+    it 'coalesces calls of concurrent threads' do
+      Array.new(8) { Thread.new { 10.times { conn.call('test1', []).wait } } }.each(&:join)
+      expect(conn.stats[:send_calls]).to be < 80
+    end
+
+    it 'validates cork options' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', cork: -1) }.to raise_error(ArgumentError)
+      expect { LWTarantool.new(url: '127.0.0.1:3301', cork: true, cork_bytes: 0) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context '#io' do
+    it 'returns IO for connection socket' do
+      expect(conn.io).to be_a IO
+      expect(conn.io.fileno).to be > 0
+    end
+
+    it 'returns nil when disconnected' do
+      conn.disconnect
+      expect(conn.io).to be_nil
+    end
+  end
+
+  context 'idempotent calls' do
+    let(:options) { {} }
+
+    let(:conn) do
+      LWTarantool.new(url: '127.0.0.1:3301', idempotent: %w[test3 fiber.sleep error], **options)
+    end
+
+    it 'shares identical calls in flight' do
+      req = conn.call('test3', [1, 2])
+
+      expect(conn.call('test3', [1, 2])).to be(req)
+      expect(conn.call('test3', [1, 3])).not_to be(req)
+      expect(req.result).to eq [1, 2]
+      expect(conn.stats[:call_coalesced]).to eq 1
+      expect(conn.stats[:call_cache_misses]).to eq 2
+    end
+
+    it 'shares a call between threads' do
+      reqs = Array.new(5) { Thread.new { conn.call('fiber.sleep', [0.2]).tap(&:wait) } }.map(&:value)
+
+      expect(reqs.uniq.size).to eq 1
+      expect(conn.stats[:call_cache_misses]).to eq 1
+    end
+
+    context 'in multiplex mode' do
+      let(:options) { { multiplex: true } }
+
+      it 'wakes up all waiters of a shared call' do
+        reqs = Array.new(5) { Thread.new { conn.call('fiber.sleep', [0.2]).tap(&:wait) } }.map(&:value)
+
+        expect(reqs.uniq.size).to eq 1
+        expect(reqs.first.ready?).to eq true
+      end
+    end
+
+    it "doesn't hold other calls while sending" do
+      cache = LWTarantool::CallCache.new(%w[f])
+      sending = Queue.new
+      proceed = Queue.new
+      thread = Thread.new { cache.fetch('f', 'a') { sending << true && proceed.pop && conn.call('test1', []) } }
+      sending.pop
+
+      expect(cache.fetch('f', 'b') { conn.call('test1', []) }.result).to eq [[1, 2, 3]]
+      proceed << true
+      expect(thread.value.result).to eq [[1, 2, 3]]
+    end
+
+    it 'sends an identical call again after a failed send' do
+      cache = LWTarantool::CallCache.new(%w[f])
+
+      expect { cache.fetch('f', 'a') { raise LWTarantool::Error, 'failed' } }.to raise_error(LWTarantool::Error)
+      expect(cache.fetch('f', 'a') { conn.call('test1', []) }.result).to eq [[1, 2, 3]]
+    end
+
+    it "doesn't share calls of other functions" do
+      req = conn.call('test1', [])
+      expect(conn.call('test1', [])).not_to be(req)
+    end
+
+    it "doesn't reuse completed calls without cache" do
+      req = conn.call('test3', [1]).tap(&:wait)
+      expect(conn.call('test3', [1])).not_to be(req)
+    end
+
+    it 'ignores release of shared request' do
+      req = conn.call('test3', [1]).tap(&:wait)
+      req.release
+
+      expect(req.result).to eq [1]
+    end
+
+    context 'with native encoder' do
+      let(:options) { { encoder: :native } }
+
+      it 'shares identical calls' do
+        req = conn.call('test3', [1, 'a'])
+
+        expect(conn.call('test3', [1, 'a'])).to be(req)
+        expect(req.result).to eq [1, 'a']
+      end
+    end
+
+    context 'with cache' do
+      let(:options) { { cache_bytes: 1200, cache_ttl: 0.3 } }
+
+      it 'serves repeated calls from cache' do
+        req = conn.call('test3', [1]).tap(&:wait)
+
+        expect(conn.call('test3', [1])).to be(req)
+        expect(conn.stats[:call_cache_hits]).to eq 1
+        expect(conn.stats[:call_cache_entries]).to eq 1
+        expect(conn.stats[:call_cache_bytes]).to be > 0
+      end
+
+      it 'expires cached replies' do
+        req = conn.call('test3', [1]).tap(&:wait)
+        sleep 0.4
+
+        expect(conn.call('test3', [1])).not_to be(req)
+      end
+
+      it "doesn't cache errors" do
+        req = conn.call('error', ['boom']).tap(&:wait)
+
+        expect(conn.call('error', ['boom'])).not_to be(req)
+      end
+
+      it 'evicts the least recently used replies over memory limit' do
+        reqs = %w[a b c].map { |s| conn.call('test3', [s * 200]).tap(&:wait) }
+        conn.call('test3', ['d' * 200]).wait
+
+        expect(conn.stats[:call_cache_entries]).to eq 2
+        expect(conn.stats[:call_cache_evictions]).to eq 2
+        expect(conn.call('test3', ['c' * 200])).to be(reqs[2])
+        expect(conn.call('test3', ['a' * 200])).not_to be(reqs[0])
+      end
+    end
+
+    it 'validates cache options' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', idempotent: %w[f], cache_bytes: -1) }.to raise_error(ArgumentError)
+      expect { LWTarantool.new(url: '127.0.0.1:3301', idempotent: %w[f], cache_ttl: 0) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context '#stats' do
+    it 'returns reply pool stats' do
+      expect(conn.stats).to include(:pool_hits, :pool_misses, :pool_hit_rate, :pool_cached_bytes)
+    end
+
+    it 'keeps buffers of unreleased replies' do
+      reqs = Array.new(3) { conn.call('test1', []) }
+      reqs.each(&:wait)
+      expect(conn.stats[:pool_buffers_in_use]).to eq 3
+      expect(conn.stats[:pool_misses]).to eq 3
+    end
+  end
+
+  context 'metrics' do
+    it 'counts traffic and syscalls' do
+      conn.call_many([['test1', []], ['test1', []]]).each(&:wait)
+      stats = conn.stats
+
+      expect(stats[:send_calls]).to be >= 1
+      expect(stats[:recv_calls]).to be >= 1
+      expect(stats[:bytes_sent]).to be > 0
+      expect(stats[:bytes_received]).to be > 0
+      expect(stats[:replies_per_recv]).to be > 0
+      expect(stats[:in_flight_max]).to eq 2
+    end
+
+    it 'counts replies per recv which got data' do
+      3.times { conn.call('test1', []).wait }
+      expect(conn.stats[:replies_per_recv]).to eq 1.0
+    end
+
+    it 'returns latency percentiles' do
+      conn.call('fiber.sleep', [0.05]).wait
+      stats = conn.stats
+
+      expect(stats[:latency_p50]).to be_between(0.045, 1)
+      expect(stats[:latency_p999]).to eq stats[:latency_max]
+      expect(conn.latency.count).to eq 1
+    end
+
+    it 'measures connection lock wait time' do
+      expect(conn.stats[:lock_wait_time]).to eq 0.0
+      Array.new(3) { Thread.new { conn.call('test1', []).wait } }.each(&:join)
+      expect(conn.stats[:lock_wait_time]).to be >= 0.0
+    end
+
+    it "doesn't keep function latency by default" do
+      conn.call('test1', []).wait
+      expect(conn.function_latency).to eq nil
+    end
+
+    context 'with function_metrics' do
+      let(:conn) { LWTarantool.new(url: '127.0.0.1:3301', function_metrics: true) }
+
+      it 'keeps latency of every function' do
+        conn.call('test1', []).wait
+        conn.call_many([['test1', []], ['fiber.sleep', [0.05]]]).each(&:wait)
+
+        expect(conn.function_latency.keys.sort).to eq %w[fiber.sleep test1]
+        expect(conn.function_latency['test1'].count).to eq 2
+        expect(conn.function_latency['fiber.sleep'].percentile(50)).to be >= 0.045
+      end
+    end
+
+    context 'with on_reply hook' do
+      let(:replies) { [] }
+      let(:conn) { LWTarantool.new(url: '127.0.0.1:3301', on_reply: ->(req) { replies << req }) }
+
+      it 'calls hook with every read request' do
+        req = conn.call('test1', []).tap(&:wait)
+
+        expect(replies).to eq [req]
+        expect(req.function).to eq 'test1'
+      end
+
+      it 'calls hook in multiplex mode' do
+        conn = LWTarantool.new(url: '127.0.0.1:3301', multiplex: true, on_reply: ->(req) { replies << req })
+        reqs = Array.new(3) { Thread.new { conn.call('test1', []).tap(&:wait) } }.map(&:value)
+
+        expect(replies.size).to eq 3
+        expect(replies.map(&:function).uniq).to eq ['test1']
+        expect(replies.map(&:object_id).sort).to eq reqs.map(&:object_id).sort
+      end
+    end
+
+    it 'validates on_reply option' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', on_reply: 1) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context 'standby' do
+    let(:conn) do
+      LWTarantool.new(url: '127.0.0.1:3301', standby: true).tap do |conn|
+        sleep 0.01 until conn.instance_eval { @standby }.connected?
+      end
+    end
+
+    it 'requires true or url' do
+      expect { LWTarantool.new(url: '127.0.0.1:3301', standby: 1) }.to raise_error(ArgumentError, /standby/)
+    end
+
+    it 'takes over standby after connection failure' do
+      conn.instance_eval { drop }
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      expect(conn.stats[:failovers]).to eq 1
+    end
+
+    it 'connects again instead of closed standby' do
+      conn
+      stop_tarantool
+      start_tarantool
+      expect { conn.call('test1', []) }.not_to raise_exception
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      expect(conn.stats[:failovers]).to eq 0
+    end
+
+    it 'is closed by disconnect' do
+      conn.disconnect
+      expect(conn.instance_eval { @standby }.connected?).to be false
+    end
+
+    it "doesn't wait for standby which is still connecting" do
+      # accepted by kernel, but never sends greeting
+      server = TCPServer.new('127.0.0.1', 0)
+      conn = LWTarantool.new(url: '127.0.0.1:3301', standby: "127.0.0.1:#{server.addr[1]}", connect_timeout: 2)
+      sleep 0.1
+      conn.instance_eval { drop }
+
+      started = Time.now
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      expect(Time.now - started).to be < 1
+      expect(conn.stats[:failovers]).to eq 0
+    ensure
+      server&.close
+    end
   end
 
   context '#connected?' do
@@ -0,0 +1,137 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# Generator of snapshot and xlog fixtures.
+#
+# Files are laid out the way Tarantool 2.11 writes them: a meta block,
+# transactions with a 19 bytes fixed header (marker, msgpack length, zero
+# crc32 of the previous transaction, crc32c of this one, str padding),
+# rows of multi-statement transactions with tsn and commit flag, zstd
+# compressed transactions of 2KB and more and the EOF marker.
+#
+# Requires the msgpack gem and the zstd command.
+#
+# Usage:
+#   spec/fixtures/xlog/generate.rb [dir]
+
+require 'msgpack'
+require 'open3'
+
+dir = ARGV[0] || __dir__
+
+VERSION = 'Version: 2.11.1-0-g96877bd35'
+INSTANCE = 'Instance: 7d8e1c44-3b1a-4f0e-9c2e-5b6a7c8d9e0f'
+
+ROW_MARKER = 0xd5ba0bab
+ZROW_MARKER = 0xd5ba0bba
+EOF_MARKER = 0xd510aded
+
+FIXHEADER_SIZE = 19
+COMPRESS_THRESHOLD = 2048
+
+TYPES = { insert: 2, replace: 3, update: 4, delete: 5, upsert: 9, raft: 30, raft_promote: 31 }.freeze
+
+CRC32C = Array.new(256) do |n|
+  8.times { n = n.odd? ? 0x82f63b78 ^ (n >> 1) : n >> 1 }
+  n
+end.freeze
+
+def crc32c(data)
+  ~data.each_byte.inject(0xffffffff) { |crc, b| CRC32C[(crc ^ b) & 0xff] ^ (crc >> 8) } & 0xffffffff
+end
+
+# Header keys are encoded in the order of xrow_header_encode(), zeros are omitted.
+def xrow(row)
+  header = { 0x00 => TYPES.fetch(row[:type]) }
+  header[0x02] = row[:replica_id] if row[:replica_id]
+  header[0x03] = row[:lsn] if row[:lsn]
+  header[0x04] = row[:timestamp] if row[:timestamp]
+  header[0x08] = row[:tsn] if row[:tsn]
+  header[0x09] = 1 if row[:commit]
+
+  header.to_msgpack + row[:body].to_msgpack
+end
+
+def fixheader(marker, data)
+  header = [marker].pack('N') + data.bytesize.to_msgpack + 0.to_msgpack + crc32c(data).to_msgpack
+  padding = FIXHEADER_SIZE - header.bytesize
+  header << [0xa0 | (padding - 1)].pack('C') << "\0" * (padding - 1) if padding.positive?
+  header.b
+end
+
+def transaction(rows)
+  data = rows.map { |row| xrow(row) }.join.b
+  return fixheader(ROW_MARKER, data) + data if data.bytesize < COMPRESS_THRESHOLD
+
+  compressed, status = Open3.capture2('zstd', '-q', '-3', '--no-check', '-c', stdin_data: data, binmode: true)
+  raise 'zstd failed' unless status.success?
+
+  fixheader(ZROW_MARKER, compressed.b) + compressed.b
+end
+
+def write(path, type, meta, txs, eof: true, tail: nil)
+  data = "#{type}\n0.13\n#{VERSION}\n#{INSTANCE}\n#{meta.join("\n")}\n\n".b
+  txs.each { |rows| data << transaction(rows) }
+  data << tail.b if tail
+  data << [EOF_MARKER].pack('N') if eof
+
+  File.binwrite(path, data)
+end
+
+def dml(type, lsn, space, timestamp, **fields)
+  body = { 0x10 => space }
+  body[0x11] = fields[:index] if fields[:index]
+  body[0x20] = fields[:key] if fields[:key]
+  body[0x21] = fields[:tuple] if fields[:tuple]
+  body[0x21] = fields[:ops] if fields[:ops] && !fields[:tuple]
+  body[0x28] = fields[:ops] if fields[:ops] && fields[:tuple]
+  body[0x15] = 1 if type == :update || type == :upsert
+
+  { type: type, replica_id: 1, lsn: lsn, timestamp: timestamp, body: body }
+end
+
+# Snapshot: raft and synchro state, then system and user spaces in space id order.
+snap_tuples = [
+  [272, ['cluster', '3e0c3a3c-47e4-4bd4-8b8e-4a0d0f7f0e1a']],
+  [272, ['max_id', 513]],
+  [272, ['version', 2, 11, 1]],
+  [280, [512, 1, 'test', 'memtx', 0, {}, [{ 'name' => 'id', 'type' => 'unsigned' }, { 'name' => 'name', 'type' => 'string' }]]],
+  [280, [513, 1, 'scores', 'memtx', 0, {}, []]],
+  [288, [512, 0, 'primary', 'tree', { 'unique' => true }, [[0, 'unsigned']]]],
+  [288, [513, 0, 'primary', 'tree', { 'unique' => true }, [[0, 'unsigned']]]],
+  [512, [1, 'a']],
+  [512, [2, 'b']],
+  [512, [3, 'c']],
+  [513, [1, 1.5]]
+]
+
+snap_rows = [
+  { type: :raft, body: { 0x00 => 1, 0x01 => 0 } },
+  { type: :raft_promote, body: { 0x02 => 0, 0x03 => 0, 0x53 => 0 } }
+]
+snap_tuples.each_with_index do |(space, tuple), i|
+  snap_rows << { type: :insert, lsn: i + 1, timestamp: 1_697_544_000.5, body: { 0x10 => space, 0x21 => tuple } }
+end
+
+write(File.join(dir, '00000000000000000000.snap'), 'SNAP', ['VClock: {}'], [snap_rows])
+
+write(File.join(dir, '00000000000000000000.xlog'), 'XLOG', ['VClock: {}'], [
+        [dml(:insert, 1, 512, 1_697_544_001.25, tuple: [4, 'd'])],
+        [dml(:replace, 2, 512, 1_697_544_002.25, tuple: [1, 'A'])],
+        [
+          dml(:update, 3, 512, 1_697_544_003.25, key: [2], ops: [['=', 2, 'B']]).merge(tsn: 3),
+          dml(:delete, 4, 513, 1_697_544_003.25, key: [1]).merge(tsn: 3, commit: true)
+        ]
+      ])
+
+# the first transaction is large enough to be compressed
+write(File.join(dir, '00000000000000000004.xlog'), 'XLOG', ['VClock: {1: 4}', 'PrevVClock: {}'], [
+        [dml(:insert, 5, 512, 1_697_544_005.25, tuple: [5, 'e' * 4096])],
+        [dml(:upsert, 6, 513, 1_697_544_006.25, tuple: [2, 2.5], ops: [['+', 2, 1]])]
+      ])
+
+# an xlog being written: no EOF marker, the last transaction is incomplete
+partial = transaction([dml(:insert, 8, 512, 1_697_544_008.25, tuple: [8, 'h'])])
+write(File.join(dir, '00000000000000000006.xlog'), 'XLOG', ['VClock: {1: 6}', 'PrevVClock: {1: 4}'], [
+        [dml(:insert, 7, 512, 1_697_544_007.25, tuple: [7, 'g'])]
+      ], eof: false, tail: partial[0, 12])
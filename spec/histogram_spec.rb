@@ -0,0 +1,45 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+describe 'LWTarantool::Histogram' do
+  let(:hist) { LWTarantool::Histogram.new }
+
+  it 'is empty by default' do
+    expect(hist.count).to eq 0
+    expect(hist.max).to eq 0.0
+    expect(hist.percentile(99)).to eq 0.0
+  end
+
+  it 'returns percentiles within bucket precision' do
+    (1..1000).each { |i| hist.record(i / 1000.0) }
+
+    expect(hist.count).to eq 1000
+    expect(hist.sum).to be_within(0.001).of(500.5)
+    expect(hist.percentile(50)).to be_within(0.5 / 16).of(0.5)
+    expect(hist.percentile(99)).to be_within(0.99 / 16).of(0.99)
+    expect(hist.percentile(100)).to eq 1.0
+    expect(hist.max).to eq 1.0
+  end
+
+  it 'keeps small values exactly' do
+    [0, 0.000003, 0.000007].each { |v| hist.record(v) }
+
+    expect(hist.percentile(0)).to eq 0.0
+    expect(hist.percentile(50)).to eq 0.000003
+    expect(hist.max).to eq 0.000007
+  end
+
+  it 'copies values on dup' do
+    hist.record(0.1)
+    copy = hist.dup
+    hist.reset
+
+    expect(hist.count).to eq 0
+    expect(copy.count).to eq 1
+  end
+
+  it 'validates percentile' do
+    expect { hist.percentile(101) }.to raise_error(ArgumentError)
+  end
+end
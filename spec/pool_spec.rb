@@ -0,0 +1,99 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+describe 'LWTarantool::Pool' do
+  before(:each) do
+    start_tarantool '
+      require "fiber";
+      function test1() return {1, 2, 3}; end
+      function test3(p1, p2) return p1, p2; end
+    '
+  end
+
+  after(:each) do
+    pool.close
+    stop_tarantool
+  end
+
+  let(:pool) do
+    LWTarantool::Pool.new(url: '127.0.0.1:3301', size: 2, reconnect_interval: 0.1)
+  end
+
+  context '#initialize' do
+    it 'create connections' do
+      expect(pool.connections.size).to eq 2
+      expect(pool.connections.map(&:connected?)).to eq [true, true]
+    end
+
+    it 'create connections for every url' do
+      pool = LWTarantool::Pool.new(url: %w[127.0.0.1:3301 localhost:3301], size: 2)
+      expect(pool.connections.map(&:url)).to eq %w[127.0.0.1:3301 127.0.0.1:3301 localhost:3301 localhost:3301]
+      pool.close
+    end
+
+    it 'not raise if url is unavailable' do
+      pool = LWTarantool::Pool.new(url: %w[127.0.0.1:3301 127.0.0.1:3399])
+      expect(pool.connections.map(&:connected?)).to eq [true, false]
+      pool.close
+    end
+
+    it 'raise on invalid size' do
+      expect { LWTarantool::Pool.new(url: '127.0.0.1:3301', size: 0) }.to raise_error(ArgumentError)
+    end
+  end
+
+  context '#call' do
+    it 'returns Request' do
+      expect(pool.call('test1', []).result).to eq [[1, 2, 3]]
+    end
+
+    it 'use connection with fewest requests in flight' do
+      req1 = pool.call('fiber.sleep', [0.2])
+      req2 = pool.call('fiber.sleep', [0.2])
+      expect(pool.connections.map(&:in_flight)).to eq [1, 1]
+      expect(req1.conn).not_to be req2.conn
+    end
+
+    it "doesn't count timed out requests in flight" do
+      slow = pool.call('fiber.sleep', [0.3], timeout: 0.05).tap(&:wait)
+      expect(slow.conn.in_flight).to eq 0
+
+      reqs = Array.new(2) { pool.call('fiber.sleep', [0.1]) }
+      expect(reqs.map(&:conn)).to include(slow.conn)
+    end
+
+    it 'skip unavailable members' do
+      pool = LWTarantool::Pool.new(url: %w[127.0.0.1:3399 127.0.0.1:3301])
+      expect(Array.new(4) { pool.call('test3', [1, 2]).result }).to all(eq [1, 2])
+      pool.close
+    end
+
+    it 'raise if all members failed' do
+      pool
+      stop_tarantool
+      expect { 3.times { pool.call('test1', []).wait } }.to raise_error(LWTarantool::SystemError)
+    end
+  end
+
+  context '#stats' do
+    it 'returns stats of every member' do
+      pool.call('test1', []).wait
+      stats = pool.stats
+      expect(stats.size).to eq 2
+      expect(stats.sum { |s| s[:calls] }).to eq 1
+      expect(stats.first).to include(:url, :connected, :in_flight, :errors, :latency_avg)
+    end
+  end
+
+  context 'background reconnect' do
+    it 'reconnect failed members' do
+      pool
+      stop_tarantool
+      pool.connections.each(&:disconnect)
+      start_tarantool
+      sleep 0.5
+      expect(pool.connections.map(&:connected?)).to eq [true, true]
+    end
+  end
+end
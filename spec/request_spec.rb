@@ -39,6 +39,29 @@ describe 'LWTarantool::Request' do
       req.wait
       expect(req.result).to eq [[1, 2, 3]]
     end
+
+    it 'fail request on timeout' do
+      req = conn.call('fiber.sleep', [0.5])
+      started = Time.now
+      req.wait(0.1)
+      expect(Time.now - started).to be < 0.4
+      expect(req.ready?).to eq true
+      expect(req.error).to match(/timed out/)
+      expect(req.result).to be_nil
+    end
+
+    it 'drop late response of timed out request' do
+      conn.call('fiber.sleep', [0.2]).wait(0.05)
+      sleep 0.3
+      expect(conn.call('test1', []).result).to eq [[1, 2, 3]]
+      expect(conn.connected?).to eq true
+    end
+
+    it 'use deadline of call' do
+      req = conn.call('fiber.sleep', [0.5], timeout: 0.1)
+      req.wait
+      expect(req.error).to match(/timed out/)
+    end
   end
 
   context '#result' do
@@ -62,6 +85,197 @@ describe 'LWTarantool::Request' do
       expect(req.error).not_to be_nil
       expect(req.result).to be_nil
     end
+
+    it 'decodes types' do
+      args = [nil, true, -1, 2**64 - 1, 1.5, 'str', [1, [2]], { 'a' => 'b' }]
+      expect(conn.call('test3', [args, 'x'.b]).result).to eq [args, 'x'.b]
+    end
+
+    it 'returns UTF-8 strings' do
+      expect(conn.call('test3', %w[aaa bbb]).result.first.encoding).to eq Encoding::UTF_8
+    end
+
+    it 'returns the first tuple' do
+      expect(conn.call('test2', []).result(first: true)).to eq 1
+      expect(conn.call('test3', []).result(first: true)).to be_nil
+    end
+
+    it 'returns tuples of range' do
+      req = conn.call('test2', [])
+      expect(req.result(range: 1..2)).to eq [2, 3]
+      expect(req.result(range: 1..)).to eq [2, 3]
+      expect(req.result(range: 3..)).to eq []
+      expect(req.result(range: 5..6)).to be_nil
+    end
+
+    it 'symbolizes keys' do
+      res = conn.call('test3', [{ 'a' => { 'b' => 1 } }, 'x']).result(symbolize_keys: true)
+      expect(res).to eq [{ a: { b: 1 } }, 'x']
+    end
+
+    it 'symbolizes keys with collectable symbols' do
+      key = "key_#{rand(1 << 32)}"
+      expect(conn.call('test3', [{ key => 1 }, 'x']).result(symbolize_keys: true)[0].keys.map(&:to_s)).to eq [key]
+
+      GC.start
+      expect(Symbol.all_symbols.any? { |sym| sym.to_s == key }).to eq false
+    end
+
+    it 'freezes strings' do
+      res = conn.call('test3', %w[aaa aaa]).result(freeze: true)
+      expect(res).to all(be_frozen)
+      expect(res[0]).to be res[1]
+    end
+  end
+
+  context '#each_tuple' do
+    it 'yields tuples one by one' do
+      tuples = []
+      req = conn.call('test2', [])
+      expect(req.each_tuple { |t| tuples << t }).to eq req
+      expect(tuples).to eq [1, 2, 3]
+    end
+
+    it 'returns Enumerator without a block' do
+      expect(conn.call('test3', [{ 'a' => 1 }, 'x']).each_tuple(symbolize_keys: true).to_a).to eq [{ a: 1 }, 'x']
+    end
+
+    it 'raises if reply is released while iterating' do
+      req = conn.call('test2', [])
+      expect { req.each_tuple { req.release } }.to raise_error(LWTarantool::Error, /released/)
+    end
+
+    it 'yields nothing when request failed' do
+      expect(conn.call('error', ['boom']).each_tuple.to_a).to eq []
+    end
+  end
+
+  context '#size' do
+    it 'returns number of tuples' do
+      expect(conn.call('test2', []).size).to eq 3
+      expect(conn.call('test1', []).size).to eq 1
+    end
+
+    it 'returns nil when request failed' do
+      expect(conn.call('error', ['boom']).size).to eq nil
+    end
+  end
+
+  context '#latency' do
+    it 'returns nil until reply is read' do
+      expect(conn.call('test1', []).latency).to eq nil
+    end
+
+    it 'returns seconds between send and reply' do
+      req = conn.call('fiber.sleep', [0.05]).tap(&:wait)
+      expect(req.latency).to be_between(0.05, 1)
+    end
+  end
+
+  context '#columns' do
+    before(:each) do
+      conn.execute('CREATE TABLE t (id INTEGER PRIMARY KEY, name STRING)').wait
+      conn.execute('INSERT INTO t VALUES (1, ?), (2, ?), (3, ?)', %w[a b c]).wait
+    end
+
+    it 'returns values by column' do
+      req = conn.execute('SELECT id, name FROM t')
+      expect(req.columns).to eq('ID' => [1, 2, 3], 'NAME' => %w[a b c])
+    end
+
+    it 'symbolizes column names and freezes strings' do
+      res = conn.execute('SELECT id, name FROM t').columns(symbolize_keys: true, freeze: true)
+      expect(res.keys).to eq [:ID, :NAME]
+      expect(res[:NAME]).to all(be_frozen)
+    end
+
+    it 'returns nil without result set' do
+      expect(conn.execute('INSERT INTO t VALUES (4, ?)', ['d']).columns).to eq nil
+      expect(conn.call('test1', []).columns).to eq nil
+    end
+  end
+
+  context '#release' do
+    it 'returns reply buffer to pool' do
+      req = conn.call('test3', ['x' * 1000])
+      req.wait
+      expect(conn.stats[:pool_buffers_in_use]).to eq 1
+      req.release
+      expect(conn.stats[:pool_buffers_in_use]).to eq 0
+      expect(conn.stats[:pool_cached_bytes]).to be > 0
+    end
+
+    it 'reuses released buffers' do
+      conn.call('test3', ['x' * 1000]).tap(&:wait).release
+      conn.call('test3', ['y' * 1000]).tap(&:wait).release
+      expect(conn.stats[:pool_hits]).to eq 1
+      expect(conn.stats[:pool_misses]).to eq 1
+      expect(conn.stats[:pool_hit_rate]).to eq 0.5
+    end
+
+    it 'keeps request ready' do
+      req = conn.call('test1', [])
+      req.wait
+      req.release
+      expect(req.ready?).to eq true
+      expect { req.result }.to raise_error(LWTarantool::Error, /released/)
+    end
+
+    it 'does nothing for not processed request' do
+      req = conn.call('test1', [])
+      req.release
+      expect(req.result).to eq [[1, 2, 3]]
+    end
+  end
+
+  context '#detach' do
+    it 'returns frozen reply' do
+      reply = conn.call('test1', []).detach
+      expect(reply).to be_frozen
+      expect(reply.result).to eq [[1, 2, 3]]
+      expect(reply.result(first: true)).to eq [1, 2, 3]
+      expect(reply.each_tuple.to_a).to eq [[1, 2, 3]]
+      expect(reply.size).to eq 1
+      expect(reply.error).to be_nil
+    end
+
+    it 'moves reply buffer out of pool' do
+      req = conn.call('test3', ['x' * 1000])
+      reply = req.detach
+      expect(reply.bytesize).to be > 1000
+      expect(conn.stats[:pool_buffers_in_use]).to eq 0
+      expect { req.result }.to raise_error(LWTarantool::Error, /released/)
+      expect { req.detach }.to raise_error(LWTarantool::Error, /released/)
+    end
+
+    it 'copies reply of shared request' do
+      req = conn.call('test1', []).share
+      expect(req.detach.result).to eq [[1, 2, 3]]
+      expect(req.result).to eq [[1, 2, 3]]
+    end
+
+    it 'returns error of timed out request' do
+      reply = conn.call('fiber.sleep', [0.5], timeout: 0.05).tap(&:wait).detach
+      expect(reply.error).to match(/timed out/)
+      expect(reply.result).to be_nil
+    end
+
+    it 'returns error of request canceled by disconnect' do
+      req = conn.call('test1', [])
+      conn.disconnect
+      expect(req.detach.error).to match(/canceled/)
+    end
+
+    if defined?(Ractor)
+      it 'is shareable between Ractors' do
+        reply = conn.call('test3', [1, 'a']).detach
+        expect(Ractor.shareable?(reply)).to eq true
+
+        decoder = Ractor.new { Ractor.receive.result }
+        decoder.send(reply)
+        expect(decoder.take).to eq [1, 'a']
+      end
+    end
   end
 
   context '#error' do
@@ -27,8 +27,8 @@ module RSpecHelpers
 
     def write_tarantool_config(dir, conf)
       conf = [
-        conf.to_s,
         'box.cfg{}',
+        conf.to_s,
         'box.schema.user.grant("guest", "read,write,execute", "universe")',
         'box.cfg{listen=3301}'
       ].join("\n")
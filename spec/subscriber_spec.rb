@@ -0,0 +1,115 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+require 'timeout'
+
+describe 'LWTarantool::Subscriber' do
+  before(:each) do
+    start_tarantool '
+      box.schema.space.create("test", {id = 512}):create_index("pk")
+      box.schema.space.create("other", {id = 513}):create_index("pk")
+    '
+  end
+
+  after(:each) do
+    subscribers.each(&:stop)
+    stop_tarantool
+  end
+
+  let(:conn) do
+    LWTarantool.new(url: '127.0.0.1:3301')
+  end
+
+  let(:subscribers) { [] }
+
+  def subscriber(**options)
+    LWTarantool::Subscriber.new(url: '127.0.0.1:3301', ack_interval: 0.1, **options).tap { |s| subscribers << s }
+  end
+
+  def pop(queue)
+    Timeout.timeout(5) { queue.pop }
+  end
+
+  context '#each' do
+    it 'streams data changes' do
+      queue = Queue.new
+      subscriber(space: 512, vclock: 0).start(queue)
+
+      conn.insert(512, [1, 'a']).wait
+      conn.update(512, [1], [['=', 2, 'b']]).wait
+      conn.delete(512, [1]).wait
+
+      rows = Array.new(3) { pop(queue) }
+      expect(rows.map { |r| r[:type] }).to eq %i[insert update delete]
+      expect(rows[0][:space]).to eq 512
+      expect(rows[0][:tuple]).to eq [1, 'a']
+      expect(rows[1][:ops]).to eq [['=', 2, 'b']]
+      expect(rows[2][:key]).to eq [1]
+    end
+
+    it 'filters spaces' do
+      queue = Queue.new
+      subscriber(space: 513, vclock: 0).start(queue)
+
+      conn.insert(512, [1, 'a']).wait
+      conn.insert(513, [2, 'b']).wait
+
+      expect(pop(queue)[:tuple]).to eq [2, 'b']
+    end
+
+    it 'streams only new changes by default' do
+      conn.insert(512, [1, 'a']).wait
+
+      sub = subscriber(space: 512)
+      queue = Queue.new
+      sub.start(queue)
+      sleep 0.2
+
+      conn.insert(512, [2, 'b']).wait
+
+      expect(pop(queue)[:tuple]).to eq [2, 'b']
+    end
+
+    it 'resumes from vclock' do
+      queue = Queue.new
+      sub = subscriber(space: 512, vclock: 0)
+      sub.start(queue)
+
+      conn.insert(512, [1, 'a']).wait
+      pop(queue)
+      sub.stop
+      saved = sub.vclock
+
+      conn.insert(512, [2, 'b']).wait
+
+      subscriber(space: 512, vclock: saved).start(queue)
+      expect(pop(queue)[:tuple]).to eq [2, 'b']
+    end
+
+    it 'calls block' do
+      queue = Queue.new
+      subscriber(space: 512, vclock: 0).start { |row| queue << row[:lsn] }
+
+      conn.insert(512, [1, 'a']).wait
+
+      expect(pop(queue)).to be_a(Integer)
+    end
+
+    it 'raises on subscription error' do
+      sub = subscriber(replicaset_uuid: '00000000-0000-0000-0000-000000000000')
+      expect { sub.each { nil } }.to raise_error(LWTarantool::Error)
+    end
+  end
+
+  context '#stop' do
+    it 'stops streaming thread' do
+      sub = subscriber(vclock: 0)
+      thread = sub.start(Queue.new)
+      sleep 0.1
+      sub.stop
+
+      expect(thread.alive?).to eq false
+      expect(sub.connected?).to eq false
+    end
+  end
+end
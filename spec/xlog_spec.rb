@@ -0,0 +1,184 @@
+# frozen_string_literal: true
+
+require_relative 'spec_helper'
+
+# Fixtures are made by spec/fixtures/xlog/generate.rb
+describe 'LWTarantool::Xlog' do
+  let(:fixtures) { File.expand_path('fixtures/xlog', __dir__) }
+  let(:snap_path) { File.join(fixtures, '00000000000000000000.snap') }
+  let(:xlog_path) { File.join(fixtures, '00000000000000000000.xlog') }
+  let(:zstd_path) { File.join(fixtures, '00000000000000000004.xlog') }
+  let(:last_path) { File.join(fixtures, '00000000000000000006.xlog') }
+
+  # a copy of a fixture to be changed
+  def copy_fixture(path)
+    @dir ||= Dir.mktmpdir
+    File.join(@dir, File.basename(path)).tap { |copy| FileUtils.cp(path, copy) }
+  end
+
+  after(:each) do
+    FileUtils.remove_entry(@dir) if @dir
+  end
+
+  context '.open' do
+    it 'reads meta' do
+      LWTarantool::Snapshot.open(snap_path) do |snap|
+        expect(snap.meta['type']).to eq 'SNAP'
+        expect(snap.meta['version']).to eq '0.13'
+        expect(snap.meta['Instance']).to eq '7d8e1c44-3b1a-4f0e-9c2e-5b6a7c8d9e0f'
+      end
+
+      LWTarantool::Xlog.open(last_path) do |xlog|
+        expect(xlog.meta['VClock']).to eq '{1: 6}'
+        expect(xlog.meta['PrevVClock']).to eq '{1: 4}'
+      end
+    end
+
+    it 'closes file after block' do
+      snap = LWTarantool::Snapshot.open(snap_path) { |s| s }
+      expect(snap.closed?).to eq true
+    end
+
+    it 'checks file type' do
+      expect { LWTarantool::Xlog.open(snap_path) }.to raise_error(LWTarantool::XlogError)
+      expect { LWTarantool::Snapshot.open(xlog_path) }.to raise_error(LWTarantool::XlogError)
+    end
+
+    it 'checks file version' do
+      path = copy_fixture(xlog_path)
+      IO.binwrite(path, IO.binread(path).sub("\n0.13\n", "\n0.12\n"))
+      expect { LWTarantool::Xlog.open(path) }.to raise_error(LWTarantool::XlogError, /version/)
+    end
+
+    it 'raises on missing file' do
+      expect { LWTarantool::Xlog.open(File.join(fixtures, 'none.xlog')) }.to raise_error(Errno::ENOENT)
+    end
+  end
+
+  context 'Snapshot#each_tuple' do
+    it 'yields all tuples' do
+      LWTarantool::Snapshot.open(snap_path) do |snap|
+        tuples = snap.each_tuple.to_a
+        expect(tuples.size).to eq 11
+        expect(tuples.first).to eq ['cluster', '3e0c3a3c-47e4-4bd4-8b8e-4a0d0f7f0e1a']
+        expect(tuples.last(4)).to eq [[1, 'a'], [2, 'b'], [3, 'c'], [1, 1.5]]
+      end
+    end
+
+    it 'filters by space' do
+      LWTarantool::Snapshot.open(snap_path) do |snap|
+        expect(snap.each_tuple(space: 513).to_a).to eq [[1, 1.5]]
+        expect(snap.each_tuple(space: [512, 600]).to_a).to eq [[1, 'a'], [2, 'b'], [3, 'c']]
+        expect(snap.each_tuple(space: 280).map { |t| t[2] }).to eq %w[test scores]
+      end
+    end
+
+    it 'freezes strings and symbolizes keys' do
+      LWTarantool::Snapshot.open(snap_path) do |snap|
+        expect(snap.each_tuple(space: 512, freeze: true).first[1].frozen?).to eq true
+        expect(snap.each_tuple(space: 288, symbolize_keys: true).first[4]).to eq(unique: true)
+      end
+    end
+  end
+
+  context 'Snapshot#each_row' do
+    it 'yields service rows without space' do
+      rows = LWTarantool::Snapshot.open(snap_path) { |snap| snap.each_row.first(3) }
+
+      expect(rows.map { |r| r[:type] }).to eq [30, 31, :insert]
+      expect(rows[0].key?(:space)).to eq false
+      expect(rows[2].values_at(:lsn, :space, :timestamp)).to eq [1, 272, 1_697_544_000.5]
+    end
+  end
+
+  context '#each_tuple' do
+    it 'skips changes other than insert and replace' do
+      LWTarantool::Xlog.open(xlog_path) do |xlog|
+        expect(xlog.each_tuple.to_a).to eq [[4, 'd'], [1, 'A']]
+      end
+    end
+
+    it 'raises on closed file' do
+      xlog = LWTarantool::Xlog.open(xlog_path)
+      xlog.close
+      expect { xlog.each_tuple.to_a }.to raise_error(LWTarantool::XlogError)
+    end
+
+    it 'raises on corrupted file' do
+      path = copy_fixture(xlog_path)
+      IO.binwrite(path, IO.binread(path).sub("\xd5\xba\x0b\xab".b, 'junk'))
+
+      LWTarantool::Xlog.open(path) do |xlog|
+        expect { xlog.each_tuple.to_a }.to raise_error(LWTarantool::XlogError)
+      end
+    end
+  end
+
+  context '#each_row' do
+    it 'yields decoded rows' do
+      rows = LWTarantool::Xlog.open(xlog_path) { |xlog| xlog.each_row.to_a }
+
+      expect(rows.map { |r| r[:type] }).to eq %i[insert replace update delete]
+      expect(rows.map { |r| r[:lsn] }).to eq [1, 2, 3, 4]
+      expect(rows.map { |r| r[:replica_id] }).to all(eq 1)
+      expect(rows[0][:tuple]).to eq [4, 'd']
+      expect(rows[2][:key]).to eq [2]
+      expect(rows[2][:ops]).to eq [['=', 2, 'B']]
+      expect(rows[3][:space]).to eq 513
+      expect(rows[3][:timestamp]).to eq 1_697_544_003.25
+    end
+  end
+
+  context 'compressed transactions' do
+    if LWTarantool::Xlog::ZSTD
+      it 'are decompressed' do
+        LWTarantool::Xlog.open(zstd_path) do |xlog|
+          expect(xlog.each_tuple.to_a).to eq [[5, 'e' * 4096]]
+          expect(xlog.complete?).to eq true
+        end
+      end
+
+      it 'yield upsert tuple and ops' do
+        row = LWTarantool::Xlog.open(zstd_path) { |xlog| xlog.each_row(space: 513).first }
+
+        expect(row[:type]).to eq :upsert
+        expect(row[:tuple]).to eq [2, 2.5]
+        expect(row[:ops]).to eq [['+', 2, 1]]
+      end
+    else
+      it 'raise without zstd' do
+        LWTarantool::Xlog.open(zstd_path) do |xlog|
+          expect { xlog.prepare }.to raise_error(LWTarantool::XlogError, /zstd/)
+        end
+      end
+    end
+  end
+
+  context '#complete?' do
+    it 'is true for a file with eof marker' do
+      expect(LWTarantool::Xlog.open(xlog_path) { |xlog| xlog.prepare.complete? }).to eq true
+    end
+
+    it 'is false for a file being written' do
+      LWTarantool::Xlog.open(last_path) do |xlog|
+        expect(xlog.each_tuple.to_a).to eq [[7, 'g']]
+        expect(xlog.complete?).to eq false
+      end
+    end
+  end
+
+  context '.scan' do
+    before(:each) do
+      skip 'built without zstd' unless LWTarantool::Xlog::ZSTD
+    end
+
+    it 'yields rows of all files in order' do
+      expect(LWTarantool::Xlog.scan(fixtures).map { |r| r[:lsn] }).to eq [1, 2, 3, 4, 5, 6, 7]
+    end
+
+    it 'prepares files in threads' do
+      rows = LWTarantool::Xlog.scan(fixtures, space: 512, threads: 4).to_a
+      expect(rows.map { |r| r[:lsn] }).to eq [1, 2, 3, 5, 7]
+    end
+  end
+end